@@ -212,6 +212,9 @@
 /* Tunable parameters                                                      */
 /* ----------------------------------------------------------------------- */
 
+/* Most of these are only defaults for options that can be given on the
+ * command line. Run with -h for a list. */
+
 /* Frequency of comprehensive reports-- lower values will provide more
  * info while slowing down the simulation. Higher values will give less
  * frequent updates. */
@@ -236,9 +239,42 @@
  * no variation in inflow rate. */
 #define INFLOW_RATE_VARIATION 1000
 
-/* Size of pond in X and Y dimensions. */
+/* Define this to fix the pond size at POND_SIZE_X by POND_SIZE_Y when
+ * compiling instead of taking it from the command line. Wrapping around
+ * the edges and picking random cells then divide by constants, which
+ * for power of two sizes are just masks and shifts. */
+/* #define FIXED_POND_SIZE 1 */
+
+/* Define this to require both pond dimensions to be powers of two. Cells
+ * are then picked and neighbors found with shifts and masks instead of
+ * divisions and conditional wraps, whatever the size of the pond. */
+/* #define USE_POW2_POND 1 */
+
+/* Size of pond in X and Y dimensions. With USE_POW2_POND the default is
+ * 1024 by 512, the power of two size nearest to 800 by 600. */
+#ifdef USE_POW2_POND
+#ifndef POND_SIZE_X
+#define POND_SIZE_X 1024
+#endif
+#ifndef POND_SIZE_Y
+#define POND_SIZE_Y 512
+#endif
+#else
+#ifndef POND_SIZE_X
 #define POND_SIZE_X 800
+#endif
+#ifndef POND_SIZE_Y
 #define POND_SIZE_Y 600
+#endif
+#endif /* USE_POW2_POND */
+
+/* Default number of clock ticks between checkpoints, when a checkpoint
+ * file is given with -c. Zero means only at exit. */
+#define CHECKPOINT_FREQUENCY 10000000
+
+/* Default number of reports between genome censuses, when a census file
+ * prefix is given with -g. */
+#define CENSUS_FREQUENCY 10
 
 /* Depth of pond in four-bit codons -- this is the maximum
  * genome size. This *must* be a multiple of 16! */
@@ -249,24 +285,236 @@
  * fail. Higher numbers mean lower penalties. */
 #define FAILED_KILL_PENALTY 3
 
+/* Default number of sweep ponds run at once (see runSweep()), or 0 for
+ * one per online CPU */
+#define SWEEP_PONDS 0
+
 /* Define this to use SDL. To use SDL, you must have SDL headers
  * available and you must link with the SDL library when you compile. */
 /* Comment this out to compile without SDL visualization support. */
 #define USE_SDL 1
 
-/* Define this to use threads, and how many threads to create */
+/* Define this to gzip genome census files. Comment this out to write
+ * them as plain text and not need zlib. */
+#define USE_ZLIB 1
+
+/* Define this to use threads, and how many threads to create by default */
 #define USE_PTHREADS_COUNT 4
 
+/* Define this to be able to serve a control socket (-C), a Unix domain
+ * socket that streams reports, sends pond images and genomes and takes
+ * commands such as checkpoints while the pond runs, with or without SDL.
+ * It runs in a thread of its own, so it needs USE_PTHREADS_COUNT, and is
+ * left out with USE_MPI and USE_GPU_ENGINE. See the control socket
+ * below. */
+/* #define USE_CONTROL 1 */
+
+/* When threads are used, each cell has a 32-bit lock by default.
+ * Define this to instead share this many cache line sized locks among
+ * all cells (lock striping). It must be a power of two. */
+/* #define CELL_LOCK_STRIPES 4096 */
+
+/* Define this to run cells with the tiled scheduler instead of picking
+ * them at random from the whole pond. The pond is cut into TILES_X by
+ * TILES_Y tiles (both must be even) that threads run in checkerboard
+ * phases of TILE_PHASE_TICKS ticks per tile. This needs no cell locks
+ * and runs are reproducible from the seed. See runTiled(). */
+/* #define USE_TILED_SCHEDULER 1 */
+#define TILES_X 8
+#define TILES_Y 6
+#define TILE_PHASE_TICKS 1000
+
+/* Define this to run the VM as threaded code using computed gotos
+ * instead of a switch. This needs GCC or Clang. */
+/* #define USE_THREADED_DISPATCH 1 */
+
+/* Define this to store the pond as a structure of arrays (one array per
+ * cell attribute plus a separate genome slab) instead of an array of
+ * Cell structures. This makes full-pond scans and access checks much
+ * more cache friendly. */
+/* #define USE_SOA_POND 1 */
+
+/* Define this to keep the pond totals in reports (energy, active cells,
+ * viable replicators, max generation) as running per-thread deltas
+ * instead of scanning the whole pond every report. Max generation then
+ * becomes the highest generation any cell with energy has reached. */
+/* #define USE_INCREMENTAL_STATS 1 */
+
+/* Define this to build a benchmark instead of the interactive program.
+ * Each thread runs this many clock ticks (or as many as given with -n)
+ * from BENCHMARK_SEED and then timing results are printed to stderr,
+ * ending with a machine readable [RESULT] line. Benchmarks never use
+ * SDL. */
+/* #define BENCHMARK_TICKS 2000000 */
+#define BENCHMARK_SEED 1
+
+/* Define this to have the random scheduler pick cells this many ticks
+ * ahead and prefetch them and their neighbors in the meantime. */
+/* #define CELL_PREFETCH_DEPTH 8 */
+
+/* Define this to run cells in batches of this many (up to 64) with the
+ * batch engine instead of one at a time, in lockstep with per-lane VM
+ * state. Runs don't depend on the batch size, but differ from runs with
+ * the one-at-a-time engine. See stepBatch(). */
+/* #define USE_BATCH_ENGINE 16 */
+
+/* Define this to keep genomes in a shared store instead of in each
+ * cell. Identical offspring share one reference counted copy, which is
+ * copied on write. See the genome store below. */
+/* #define USE_GENOME_STORE 1 */
+
+/* Define this to write offspring genomes with non-temporal (streaming)
+ * stores, which bypass the cache. Offspring are rarely run right after
+ * they are written, so this keeps the cache for cells that are. Needs
+ * SSE2 and is ignored without it. */
+/* #define USE_STREAMING_STORES 1 */
+
+/* Define this to split the pond across MPI ranks, each running a strip
+ * of it with the tiled scheduler and exchanging the cells at the strip
+ * edges between phases. Build with mpicc and run with mpirun; -x is then
+ * the width of the whole pond. See the distributed pond below. */
+/* #define USE_MPI 1 */
+
+/* Define this for machines with more than one NUMA node (socket). Each
+ * thread is then pinned to a CPU, taking the CPUs the process may run on
+ * in order, and the pond is first touched by the threads that run each
+ * part of it so Linux puts those pages on their nodes: the tiles a
+ * thread is at home on with the tiled scheduler (see nextTile()), or an
+ * even strip of columns per thread with the random one, which at least
+ * spreads the pond over all nodes. Needs USE_PTHREADS_COUNT and Linux. */
+/* #define USE_NUMA 1 */
+
+/* Define this to ask for transparent huge pages for the memory genomes
+ * are kept in, so that picking cells at random takes far fewer TLB
+ * entries. This needs THP enabled ("madvise" or "always" in
+ * /sys/kernel/mm/transparent_hugepage/enabled) and is ignored without. */
+/* #define USE_HUGE_PAGES 1 */
+
+/* Define this to run the tiled scheduler's phases as OpenMP offload
+ * kernels, with the pond kept in the device's memory. Each kernel runs a
+ * phase with a device thread per tile block, and reports only copy back
+ * the counters and pond totals (added up on the device). Build with
+ * -fopenmp for an offload device (e.g. a GPU, with GCC's nvptx-none or
+ * amdgcn-amdhsa offload compilers); without one the kernels run on the
+ * host's cores. A GPU needs far more tiles in parallel than the default
+ * TILES_X by TILES_Y gives. See the GPU engine below. */
+/* #define USE_GPU_ENGINE 1 */
+
+/* Define this to profile the hot path. Each thread then also counts the
+ * cycles its cell executions take, how many instructions they run, how
+ * far false LOOPs skip, how long locking neighbors takes and how often a
+ * neighbor isn't in cache, and reports get extra columns for these (see
+ * doReport()). Profiling itself slows execution down noticeably. */
+/* #define USE_PROFILING 1 */
+
+/* When profiling, loading a neighbor's energy taking at least this many
+ * reference cycles counts as a cache miss */
+#define PROFILE_MISS_CYCLES 80
+
+/* Define this to sum genomes for the KINSHIP color scheme a nibble at a
+ * time, as before kinshipSum() worked a machine word at a time. Both
+ * give the same sums. */
+/* #define KINSHIP_SCALAR 1 */
+
+/* Define this to build a check of kinshipSum() instead of the program.
+ * It prints the sums of this many random genomes and as many made up
+ * mostly of XCHGs and STOPs to stdout, and the time taken to stderr, so
+ * builds with and without KINSHIP_SCALAR can be compared (see the
+ * bench-kinship make target). */
+/* #define KINSHIP_CHECK_GENOMES 100000 */
+
+/* Define this to check after every display refresh that each pixel has
+ * the color of its cell, redrawn from scratch, and exit if not. Cells
+ * only hold still while this runs with one thread (-t 1) or with the
+ * tiled scheduler (see the check-display make target). */
+/* #define CHECK_DISPLAY 1 */
+
 /* ----------------------------------------------------------------------- */
 
+/* Benchmarks and headless builds (-DHEADLESS) never use SDL */
+#if defined(BENCHMARK_TICKS) || defined(HEADLESS)
+#undef USE_SDL
+#endif
+
+#if defined(USE_MPI) && (!defined(USE_TILED_SCHEDULER) || defined(USE_SDL) || defined(USE_POW2_POND) || defined(FIXED_POND_SIZE) || defined(USE_INCREMENTAL_STATS))
+#error USE_MPI needs USE_TILED_SCHEDULER and a headless build, and is incompatible with USE_POW2_POND, FIXED_POND_SIZE or USE_INCREMENTAL_STATS
+#endif
+
+#if defined(USE_NUMA) && (!defined(USE_PTHREADS_COUNT) || !defined(__linux__) || defined(USE_MPI))
+#error USE_NUMA needs USE_PTHREADS_COUNT and Linux, and is left to mpirun with USE_MPI
+#endif
+
+#if defined(USE_GPU_ENGINE) && (!defined(USE_TILED_SCHEDULER) || defined(USE_SDL) || defined(USE_BATCH_ENGINE) || defined(USE_THREADED_DISPATCH) || defined(USE_GENOME_STORE) || defined(USE_POW2_POND) || defined(USE_PROFILING) || defined(USE_MPI) || defined(USE_NUMA))
+#error USE_GPU_ENGINE needs USE_TILED_SCHEDULER and a headless build, and is incompatible with USE_BATCH_ENGINE, USE_THREADED_DISPATCH, USE_GENOME_STORE, USE_POW2_POND, USE_PROFILING, USE_MPI or USE_NUMA
+#endif
+#if defined(USE_GPU_ENGINE) && !defined(_OPENMP)
+#error USE_GPU_ENGINE needs OpenMP (-fopenmp)
+#endif
+
+/* The control socket has no single pond in host memory to look at with
+ * MPI or the GPU engine */
+#if defined(USE_CONTROL) && (!defined(USE_PTHREADS_COUNT) || defined(USE_MPI) || defined(USE_GPU_ENGINE))
+#undef USE_CONTROL
+#endif
+
+/* Lanes of the batch engine are tracked in a 64-bit mask */
+#if defined(USE_BATCH_ENGINE) && (USE_BATCH_ENGINE > 64)
+#error USE_BATCH_ENGINE must be at most 64
+#endif
+
+/* Cells need locks when threads pick them at random */
+#if defined(USE_PTHREADS_COUNT) && !defined(USE_TILED_SCHEDULER)
+#define USE_CELL_LOCKS 1
+#endif
+
+/* For CPU affinity */
+#ifdef USE_NUMA
+#define _GNU_SOURCE 1
+#endif
+
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 
 #ifdef USE_PTHREADS_COUNT
 #include <pthread.h>
+#include <sched.h>
+#endif
+
+#if defined(USE_STREAMING_STORES) && (!defined(__SSE2__) || defined(USE_GPU_ENGINE))
+#undef USE_STREAMING_STORES
+#endif
+#ifdef USE_STREAMING_STORES
+#include <emmintrin.h>
+#endif
+
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef USE_CONTROL
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
+
+#ifdef USE_GPU_ENGINE
+#include <omp.h>
 #endif
 
 #ifdef USE_SDL
@@ -277,19 +525,291 @@
 #endif /* _MSC_VER */
 #endif /* USE_SDL */
 
-volatile uint64_t prngState[2];
-static inline uintptr_t getRandom()
+/*
+ * Run time parameters
+ *
+ * These start out as the tunables above and may be changed from the
+ * command line by main() before anything else happens.
+ */
+static uintptr_t reportFrequency = REPORT_FREQUENCY;
+static uint64_t checkpointFrequency = CHECKPOINT_FREQUENCY;
+static uintptr_t censusFrequency = CENSUS_FREQUENCY;
+static uint32_t mutationRate = MUTATION_RATE;
+static uintptr_t inflowFrequency = INFLOW_FREQUENCY;
+static uintptr_t inflowRateBase = INFLOW_RATE_BASE;
+static uintptr_t failedKillPenalty = FAILED_KILL_PENALTY;
+#ifdef BENCHMARK_TICKS
+static uint64_t runTicks = BENCHMARK_TICKS;
+#else
+static uint64_t runTicks = 0; /* Ticks per thread to run, 0 for no limit */
+#endif
+#ifdef INFLOW_RATE_VARIATION
+static uintptr_t inflowRateVariation = INFLOW_RATE_VARIATION;
+#else
+static uintptr_t inflowRateVariation = 0;
+#endif
+
+#ifdef FIXED_POND_SIZE
+#define pondSizeX ((uintptr_t)POND_SIZE_X)
+#define pondSizeY ((uintptr_t)POND_SIZE_Y)
+#else
+static uintptr_t pondSizeX = POND_SIZE_X;
+static uintptr_t pondSizeY = POND_SIZE_Y;
+#endif
+
+#ifdef USE_POW2_POND
+#ifdef FIXED_POND_SIZE
+#if (POND_SIZE_X & (POND_SIZE_X - 1)) || (POND_SIZE_Y & (POND_SIZE_Y - 1))
+#error USE_POW2_POND needs POND_SIZE_X and POND_SIZE_Y to be powers of two
+#endif
+#define pondShiftX ((uintptr_t)__builtin_ctzl(POND_SIZE_X))
+#define pondShiftY ((uintptr_t)__builtin_ctzl(POND_SIZE_Y))
+#else
+/* log2 of the pond dimensions, set in main() */
+static uintptr_t pondShiftX;
+static uintptr_t pondShiftY;
+#endif
+
+/* v % pondSizeX, v / pondSizeX, v % pondSizeY and v / pondSizeY */
+#define POND_MOD_X(v) ((v) & (pondSizeX - 1))
+#define POND_DIV_X(v) ((v) >> pondShiftX)
+#define POND_MOD_Y(v) ((v) & (pondSizeY - 1))
+#define POND_DIV_Y(v) ((v) >> pondShiftY)
+#else
+#define POND_MOD_X(v) ((v) % pondSizeX)
+#define POND_DIV_X(v) ((v) / pondSizeX)
+#define POND_MOD_Y(v) ((v) % pondSizeY)
+#define POND_DIV_Y(v) ((v) / pondSizeY)
+#endif /* USE_POW2_POND */
+
+/* Parameters cells run with are also on the device for the GPU engine */
+#ifdef USE_GPU_ENGINE
+#pragma omp declare target(mutationRate,inflowFrequency,inflowRateBase,inflowRateVariation,failedKillPenalty)
+#ifndef FIXED_POND_SIZE
+#pragma omp declare target(pondSizeX,pondSizeY)
+#endif
+#endif
+
+/* Number of threads running the simulation */
+#ifdef USE_PTHREADS_COUNT
+static uintptr_t threadCount = USE_PTHREADS_COUNT;
+#else
+#define threadCount ((uintptr_t)1)
+#endif
+
+/**
+ * Allocates zeroed memory for the pond and other big arrays
+ *
+ * Memory is mapped straight from the OS, so it is page aligned (and
+ * therefore cache line aligned) and costs nothing until touched.
+ */
+static void *allocPondMemory(const size_t size)
+{
+	void *const p = mmap((void *)0,size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+	if (p == MAP_FAILED) {
+		fprintf(stderr,"*** Unable to allocate %lu bytes of memory ***\n",(unsigned long)size);
+		exit(1);
+	}
+	return p;
+}
+
+/* Allocates pond memory that genomes are kept in, with huge pages if
+ * USE_HUGE_PAGES */
+static void *allocGenomeMemory(const size_t size)
+{
+	void *const p = allocPondMemory(size);
+#if defined(USE_HUGE_PAGES) && defined(MADV_HUGEPAGE)
+	madvise(p,size,MADV_HUGEPAGE);
+#endif
+	return p;
+}
+
+#ifdef USE_NUMA
+/* CPUs the process may run on, taken before any thread is pinned */
+static cpu_set_t numaCpus;
+
+/* Pins the calling thread to the CPU for a thread number */
+static void pinThread(const uintptr_t threadNo)
+{
+	const int count = CPU_COUNT(&numaCpus);
+	int cpu,n = (count > 0) ? (int)(threadNo % (uintptr_t)count) : 0;
+	cpu_set_t set;
+	for(cpu=0;cpu<CPU_SETSIZE;++cpu) {
+		if ((CPU_ISSET(cpu,&numaCpus))&&(!n--)) {
+			CPU_ZERO(&set);
+			CPU_SET(cpu,&set);
+			pthread_setaffinity_np(pthread_self(),sizeof(set),&set);
+			return;
+		}
+	}
+}
+#endif /* USE_NUMA */
+
+#ifdef USE_PTHREADS_COUNT
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define CPU_RELAX() __asm__ __volatile__("yield")
+#else
+#define CPU_RELAX() ((void)0)
+#endif
+
+/* Spins before a waiting thread yields its CPU, in case the thread it
+ * waits for isn't running (e.g. there are more threads than cores). */
+#define SPINS_BEFORE_YIELD 64
+
+static inline void spinBackoff(uintptr_t *const spins)
+{
+	if (++*spins >= SPINS_BEFORE_YIELD) {
+		*spins = 0;
+		sched_yield();
+	} else CPU_RELAX();
+}
+#endif /* USE_PTHREADS_COUNT */
+
+/* Size of a cache line; per-thread state is aligned and padded to this
+ * so threads never write to the same line. */
+#define CACHE_LINE_SIZE 64
+#ifdef _MSC_VER
+#define CACHE_ALIGNED __declspec(align(CACHE_LINE_SIZE))
+#else
+#define CACHE_ALIGNED __attribute__((aligned(CACHE_LINE_SIZE)))
+#endif
+
+/**
+ * Per-thread random number generator state
+ *
+ * Each thread owns one of these, so getRandom() never touches memory
+ * shared with another thread. Rather than rolling for a mutation on
+ * every executed instruction, the number of instructions until the next
+ * mutation is drawn once and counted down.
+ */
+struct CACHE_ALIGNED PRNG
+{
+	/* xorshift128+ state */
+	uint64_t s[2];
+
+	/* Instructions left to run before the next one is mutated */
+	uint64_t mutationCountdown;
+};
+
+#ifndef USE_TILED_SCHEDULER
+static struct PRNG *prngState;
+#endif
+
+/* Seed from which each thread derives its own PRNG state */
+static uint64_t prngSeed;
+
+static inline uintptr_t getRandom(struct PRNG *const prng)
 {
 	// https://en.wikipedia.org/wiki/Xorshift#xorshift.2B
-	uint64_t x = prngState[0];
-	const uint64_t y = prngState[1];
-	prngState[0] = y;
+	uint64_t x = prng->s[0];
+	const uint64_t y = prng->s[1];
+	prng->s[0] = y;
 	x ^= x << 23;
 	const uint64_t z = x ^ y ^ (x >> 17) ^ (y >> 26);
-	prngState[1] = z;
+	prng->s[1] = z;
 	return (uintptr_t)(z + y);
 }
 
+/**
+ * Fills a buffer with random words
+ *
+ * This keeps the generator state in registers for the whole batch
+ * instead of loading and storing it for every word.
+ *
+ * @param prng Generator to use
+ * @param buf Destination
+ * @param n Number of words to generate
+ */
+static void fillRandom(struct PRNG *const prng,uintptr_t *buf,uintptr_t n)
+{
+	uint64_t x,y = prng->s[1],z = prng->s[0];
+	while (n--) {
+		x = z;
+		z = y;
+		x ^= x << 23;
+		y = x ^ z ^ (x >> 17) ^ (z >> 26);
+		*(buf++) = (uintptr_t)(y + z);
+	}
+	prng->s[0] = z;
+	prng->s[1] = y;
+}
+
+/**
+ * Draws the number of instructions to run before the next mutation
+ *
+ * Each instruction is mutated with probability mutationRate / 2^32, so
+ * the gap between mutations is geometrically distributed. It's drawn by
+ * inversion from a uniform number in (0,1].
+ */
+static double mutationGapScale; /* 1 / log(1 - probability), set in main() */
+#ifdef USE_GPU_ENGINE
+#pragma omp declare target(mutationGapScale)
+#endif
+static uint64_t getMutationGap(struct PRNG *const prng)
+{
+	if (mutationRate) {
+		const double u = ((double)((getRandom(prng) >> 11) + 1)) * (1.0 / 9007199254740992.0);
+		const double gap = log(u) * mutationGapScale;
+		return (gap < 18446744073709549568.0) ? (uint64_t)gap : ~((uint64_t)0);
+	}
+	return ~((uint64_t)0);
+}
+
+/* Counts down one instruction, returning nonzero if it gets mutated */
+static inline int checkMutation(struct PRNG *const prng)
+{
+	if (prng->mutationCountdown) {
+		--prng->mutationCountdown;
+		return 0;
+	}
+	prng->mutationCountdown = getMutationGap(prng);
+	return 1;
+}
+
+/**
+ * Counts down up to n instructions that don't get mutated
+ *
+ * This stops just before the next mutation, leaving it for
+ * checkMutation().
+ *
+ * @param prng Generator to use
+ * @param n Maximum number of instructions
+ * @return Number of instructions counted down
+ */
+static inline uintptr_t skipMutationChecks(struct PRNG *const prng,uintptr_t n)
+{
+	if (n > prng->mutationCountdown)
+		n = (uintptr_t)prng->mutationCountdown;
+	prng->mutationCountdown -= n;
+	return n;
+}
+
+/**
+ * Seeds a generator from the global seed and a stream number
+ *
+ * Threads (or tiles) use their number as the stream number. Each stream
+ * takes its own two outputs of a splitmix64 sequence started at the
+ * seed, so nearby seeds and streams still give unrelated, non-zero
+ * xorshift states.
+ */
+static void seedRandom(struct PRNG *const prng,const uint64_t seed,const uintptr_t stream)
+{
+	uint64_t z = seed + ((uint64_t)stream * 2 * 0x9e3779b97f4a7c15ULL);
+	uintptr_t i;
+	for(i=0;i<2;++i) {
+		z += 0x9e3779b97f4a7c15ULL;
+		uint64_t t = z;
+		t = (t ^ (t >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		t = (t ^ (t >> 27)) * 0x94d049bb133111ebULL;
+		prng->s[i] = t ^ (t >> 31);
+	}
+	if (!(prng->s[0] | prng->s[1]))
+		prng->s[0] = 1;
+	prng->mutationCountdown = getMutationGap(prng);
+}
+
 /* Pond depth in machine-size words.  This is calculated from
  * POND_DEPTH and the size of the machine word. (The multiplication
  * by two is due to the fact that there are two four-bit values in
@@ -299,6 +819,9 @@ static inline uintptr_t getRandom()
 /* Number of bits in a machine-size word */
 #define SYSWORD_BITS (sizeof(uintptr_t) * 8)
 
+/* Number of instructions in a machine-size word */
+#define SYSWORD_NIBBLES (sizeof(uintptr_t) * 2)
+
 /* Constants representing neighbors in the 2D grid. */
 #define N_LEFT 0
 #define N_RIGHT 1
@@ -312,6 +835,200 @@ static inline uintptr_t getRandom()
 
 /* Number of bits set in binary numbers 0000 through 1111 */
 static const uintptr_t BITS_IN_FOURBIT_WORD[16] = { 0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4 };
+#ifdef USE_GPU_ENGINE
+#pragma omp declare target(BITS_IN_FOURBIT_WORD)
+#endif
+
+/* Total number of cells in the pond */
+#define POND_SIZE (pondSizeX * pondSizeY)
+
+/* Cells are referred to by index rather than by pointer so that the
+ * same code works with either pond layout. Cells are ordered the same
+ * way as the original pond[POND_SIZE_X][POND_SIZE_Y] array. */
+#ifdef USE_POW2_POND
+#define CELL_INDEX(x,y) (((uintptr_t)(x) << pondShiftY) | (uintptr_t)(y))
+#else
+#define CELL_INDEX(x,y) (((uintptr_t)(x) * pondSizeY) + (uintptr_t)(y))
+#endif
+
+/* Columns of the pond this process runs. With MPI the first and last
+ * columns are ghosts of the neighboring ranks' edges. */
+#ifdef USE_MPI
+#define POND_OWNED_X0 ((uintptr_t)1)
+#define POND_OWNED_SIZE_X (pondSizeX - 2)
+static int mpiRank = 0;
+static int mpiRanks = 1;
+#else
+#define POND_OWNED_X0 ((uintptr_t)0)
+#define POND_OWNED_SIZE_X pondSizeX
+#endif
+#define POND_OWNED_BEGIN CELL_INDEX(POND_OWNED_X0,0)
+#define POND_OWNED_END CELL_INDEX(POND_OWNED_X0 + POND_OWNED_SIZE_X,0)
+
+#ifdef USE_GENOME_STORE
+
+/*
+ * Genome store
+ *
+ * Cells point to genome blocks instead of holding genomes. Offspring
+ * genomes are interned: they are looked up by hash in genomeTable, and if
+ * an identical one exists the child shares it and its reference count
+ * goes up. Since successful replicators fill the pond with copies of
+ * themselves this saves a lot of memory, and the empty genome every cell
+ * starts out with is only stored once.
+ *
+ * Interned blocks are never written. A cell about to write its genome
+ * (WRITEG, XCHG, being KILLed or seeded) first gets a private block of
+ * its own through genomeForWrite(), copying the interned one unless it
+ * was the only user, in which case it's just taken out of the table.
+ * Cells change blocks only while they are locked, and blocks are never
+ * returned to the system, so snapshot reads stay safe.
+ *
+ * So that threads storing offspring don't all wait on each other, the
+ * store is split into GENOME_STORE_STRIPES stripes, each with its own
+ * lock. A table bucket and the reference counts of the blocks interned
+ * in it are protected by the stripe of the bucket, and each stripe also
+ * has its own free list for the cells whose index falls in it (see
+ * genomeCellStripe()). No thread ever holds two stripe locks, and
+ * private blocks, whose only user is the locked cell, need none.
+ */
+struct GenomeBlock
+{
+	/* Next block in the same table bucket or on the free list */
+	struct GenomeBlock *next;
+
+	/* Hash of the genome, if interned */
+	uint64_t hash;
+
+	/* Cells using this block, which for a private block is one */
+	uintptr_t refs;
+
+	/* Nonzero if this block is in genomeTable */
+	uintptr_t interned;
+
+	CACHE_ALIGNED uintptr_t words[POND_DEPTH_SYSWORDS];
+};
+
+/* Blocks are allocated this many at a time for a stripe */
+#define GENOME_STORE_CHUNK 256
+
+/* Number of stripes, which must be a power of two */
+#define GENOME_STORE_STRIPES 256
+
+struct CACHE_ALIGNED GenomeStripe
+{
+	uint8_t locked;
+
+	struct GenomeBlock *freeList;
+
+	/* Number of blocks allocated for and in use by this stripe's cells */
+	uintptr_t blocks;
+	uintptr_t blocksUsed;
+};
+
+static struct GenomeBlock **genomeTable;
+static uintptr_t genomeTableMask;
+static struct GenomeStripe genomeStripes[GENOME_STORE_STRIPES];
+
+/* Stripe whose free list a cell's blocks come from and go back to */
+#define genomeCellStripe(c) (&genomeStripes[(c) & (GENOME_STORE_STRIPES - 1)])
+
+/* Stripe of the table bucket for a hash */
+#define genomeHashStripe(h) (&genomeStripes[(h) & genomeTableMask & (GENOME_STORE_STRIPES - 1)])
+
+#ifdef USE_PTHREADS_COUNT
+static inline void genomeStripeLock(struct GenomeStripe *const st)
+{
+	uintptr_t spins = 0;
+	while (__atomic_exchange_n(&st->locked,1,__ATOMIC_ACQUIRE))
+		spinBackoff(&spins);
+}
+
+static inline void genomeStripeUnlock(struct GenomeStripe *const st)
+{
+	__atomic_store_n(&st->locked,0,__ATOMIC_RELEASE);
+}
+#else
+#define genomeStripeLock(st) ((void)(st))
+#define genomeStripeUnlock(st) ((void)(st))
+#endif
+
+#endif /* USE_GENOME_STORE */
+
+#ifdef USE_SOA_POND
+
+/*
+ * Structure-of-arrays pond: each cell attribute lives in its own array,
+ * genomes live in a separate slab, and the low nibble of genome[0] (the
+ * "logo" checked by accessAllowed()) is mirrored in a compact tag array.
+ * Full-pond scans such as the one in doReport() then only stream the
+ * attributes they actually look at.
+ */
+
+/* Globally unique cell ID */
+static uint64_t *pondID;
+
+/* ID of the cell's parent */
+static uint64_t *pondParentID;
+
+/* Counter for original lineages -- equal to the cell ID of
+ * the first cell in the line. */
+static uint64_t *pondLineage;
+
+/* Generations start at 0 and are incremented from there. */
+static uintptr_t *pondGeneration;
+
+/* Energy level of each cell */
+static uintptr_t *pondEnergy;
+
+#ifdef USE_GENOME_STORE
+/* Genome block of each cell */
+static struct GenomeBlock **pondGenome;
+#else
+/* Memory space for cell genomes (genomes are stored as four
+ * bit instructions packed into machine size words) */
+static uintptr_t (*pondGenome)[POND_DEPTH_SYSWORDS];
+#endif
+
+/* Words of each cell's genome in use (see CELL_GENOME_HIGH()) */
+static uint16_t *pondGenomeHigh;
+
+/* Copy of (genome[0] & 0xf) for each cell */
+static uint8_t *pondLogo;
+
+#define CELL_ID(c) (pondID[(c)])
+#define CELL_PARENT_ID(c) (pondParentID[(c)])
+#define CELL_LINEAGE(c) (pondLineage[(c)])
+#define CELL_GENERATION(c) (pondGeneration[(c)])
+#define CELL_ENERGY(c) (pondEnergy[(c)])
+#ifdef USE_GENOME_STORE
+#define CELL_GENOME_REF(c) (pondGenome[(c)])
+#else
+#define CELL_GENOME(c) (pondGenome[(c)])
+#endif
+#define CELL_GENOME_HIGH(c) (pondGenomeHigh[(c)])
+#define CELL_LOGO(c) ((uintptr_t)pondLogo[(c)])
+
+/* Must be done whenever genome[0] of a cell may have changed */
+#define CELL_SYNC_LOGO(c) (pondLogo[(c)] = (uint8_t)(CELL_GENOME(c)[0] & 0xf))
+
+static void allocPond()
+{
+	pondID = (uint64_t *)allocPondMemory(sizeof(uint64_t) * POND_SIZE);
+	pondParentID = (uint64_t *)allocPondMemory(sizeof(uint64_t) * POND_SIZE);
+	pondLineage = (uint64_t *)allocPondMemory(sizeof(uint64_t) * POND_SIZE);
+	pondGeneration = (uintptr_t *)allocPondMemory(sizeof(uintptr_t) * POND_SIZE);
+	pondEnergy = (uintptr_t *)allocPondMemory(sizeof(uintptr_t) * POND_SIZE);
+#ifdef USE_GENOME_STORE
+	pondGenome = (struct GenomeBlock **)allocPondMemory(sizeof(struct GenomeBlock *) * POND_SIZE);
+#else
+	pondGenome = (uintptr_t (*)[POND_DEPTH_SYSWORDS])allocGenomeMemory(sizeof(uintptr_t) * POND_DEPTH_SYSWORDS * POND_SIZE);
+#endif
+	pondGenomeHigh = (uint16_t *)allocPondMemory(sizeof(uint16_t) * POND_SIZE);
+	pondLogo = (uint8_t *)allocPondMemory(POND_SIZE);
+}
+
+#else /* !USE_SOA_POND */
 
 /**
  * Structure for a cell in the pond
@@ -334,222 +1051,1337 @@ struct Cell
 	/* Energy level of this cell */
 	uintptr_t energy;
 
-	/* Memory space for cell genome (genome is stored as four
-	 * bit instructions packed into machine size words) */
-	uintptr_t genome[POND_DEPTH_SYSWORDS];
+	/* Words of genome in use (see CELL_GENOME_HIGH()) */
+	uintptr_t genomeHigh;
 
-#ifdef USE_PTHREADS_COUNT
-	pthread_mutex_t lock;
+#ifdef USE_GENOME_STORE
+	/* Genome block */
+	struct GenomeBlock *genome;
+#else
+	/* Memory space for cell genome (genome is stored as four
+	 * bit instructions packed into machine size words), starting on
+	 * its own cache line */
+	CACHE_ALIGNED uintptr_t genome[POND_DEPTH_SYSWORDS];
 #endif
 };
 
-/* The pond is a 2D array of cells */
-static struct Cell pond[POND_SIZE_X][POND_SIZE_Y];
+/* The pond is a 2D array of cells, stored flat */
+static struct Cell *pond;
 
-/* This is used to generate unique cell IDs */
-static volatile uint64_t cellIdCounter = 0;
+#define CELL_ID(c) (pond[(c)].ID)
+#define CELL_PARENT_ID(c) (pond[(c)].parentID)
+#define CELL_LINEAGE(c) (pond[(c)].lineage)
+#define CELL_GENERATION(c) (pond[(c)].generation)
+#define CELL_ENERGY(c) (pond[(c)].energy)
+#ifdef USE_GENOME_STORE
+#define CELL_GENOME_REF(c) (pond[(c)].genome)
+#else
+#define CELL_GENOME(c) (pond[(c)].genome)
+#endif
+#define CELL_GENOME_HIGH(c) (pond[(c)].genomeHigh)
+#define CELL_LOGO(c) (CELL_GENOME(c)[0] & 0xf)
+#define CELL_SYNC_LOGO(c) ((void)0)
 
-/* Currently selected color scheme */
-enum { KINSHIP,LINEAGE,MAX_COLOR_SCHEME } colorScheme = KINSHIP;
-static const char *colorSchemeName[2] = { "KINSHIP", "LINEAGE" };
+static void allocPond()
+{
+	pond = (struct Cell *)allocGenomeMemory(sizeof(struct Cell) * POND_SIZE);
+}
 
-#ifdef USE_SDL
-static SDL_Window *window;
-static SDL_Surface *winsurf;
-static SDL_Surface *screen;
+#endif /* USE_SOA_POND */
+
+#ifdef USE_GPU_ENGINE
+/*
+ * Device copy of the pond
+ *
+ * With the GPU engine the pond is mapped to the device when the run
+ * starts and cells only run there. The pond's pointers are declare
+ * target, and their device copies are pointed at the device's memory.
+ * Censuses, checkpoints and the end of the run copy the pond back.
+ */
+#ifdef USE_SOA_POND
+#pragma omp declare target(pondID,pondParentID,pondLineage,pondGeneration,pondEnergy,pondGenome,pondGenomeHigh,pondLogo)
+#else
+#pragma omp declare target(pond)
 #endif
 
-volatile struct {
-	/* Counts for the number of times each instruction was
-	 * executed since the last report. */
-	double instructionExecutions[16];
-	
-	/* Number of cells executed since last report */
-	double cellExecutions;
-	
-	/* Number of viable cells replaced by other cells' offspring */
-	uintptr_t viableCellsReplaced;
-	
-	/* Number of viable cells KILLed */
-	uintptr_t viableCellsKilled;
-	
-	/* Number of successful SHARE operations */
-	uintptr_t viableCellShares;
-} statCounters;
+/* Set once the pond is on the device */
+static int gpuPondOnDevice = 0;
 
-static void doReport(const uint64_t clock)
+/* Gets the device's address of mapped host memory */
+static void *gpuDevicePointer(void *p)
 {
-	static uint64_t lastTotalViableReplicators = 0;
+	void *d = p;
+#pragma omp target data use_device_ptr(p)
+	d = p;
+	return d;
+}
+
+/* Maps the pond and the parameters cells run with to the device */
+static void gpuEnterPond()
+{
+	const uintptr_t n = POND_SIZE;
+#ifdef USE_SOA_POND
+	void *d[8];
+#pragma omp target enter data map(to:pondID[0:n],pondParentID[0:n],pondLineage[0:n],pondGeneration[0:n],pondEnergy[0:n],pondGenome[0:n],pondGenomeHigh[0:n],pondLogo[0:n])
+	d[0] = gpuDevicePointer(pondID);
+	d[1] = gpuDevicePointer(pondParentID);
+	d[2] = gpuDevicePointer(pondLineage);
+	d[3] = gpuDevicePointer(pondGeneration);
+	d[4] = gpuDevicePointer(pondEnergy);
+	d[5] = gpuDevicePointer(pondGenome);
+	d[6] = gpuDevicePointer(pondGenomeHigh);
+	d[7] = gpuDevicePointer(pondLogo);
+#pragma omp target map(to:d)
+	{
+		pondID = (uint64_t *)d[0];
+		pondParentID = (uint64_t *)d[1];
+		pondLineage = (uint64_t *)d[2];
+		pondGeneration = (uintptr_t *)d[3];
+		pondEnergy = (uintptr_t *)d[4];
+		pondGenome = (uintptr_t (*)[POND_DEPTH_SYSWORDS])d[5];
+		pondGenomeHigh = (uint16_t *)d[6];
+		pondLogo = (uint8_t *)d[7];
+	}
+#else
+	void *d;
+#pragma omp target enter data map(to:pond[0:n])
+	d = gpuDevicePointer(pond);
+#pragma omp target map(to:d)
+	pond = (struct Cell *)d;
+#endif
+#pragma omp target update to(mutationRate,inflowFrequency,inflowRateBase,inflowRateVariation,failedKillPenalty,mutationGapScale)
+#ifndef FIXED_POND_SIZE
+#pragma omp target update to(pondSizeX,pondSizeY)
+#endif
+	gpuPondOnDevice = 1;
+}
+
+/* Copies the pond back from the device */
+static void gpuCopyPondBack()
+{
+	const uintptr_t n = POND_SIZE;
+#ifdef USE_SOA_POND
+#pragma omp target update from(pondID[0:n],pondParentID[0:n],pondLineage[0:n],pondGeneration[0:n],pondEnergy[0:n],pondGenome[0:n],pondGenomeHigh[0:n],pondLogo[0:n])
+#else
+#pragma omp target update from(pond[0:n])
+#endif
+}
+#endif /* USE_GPU_ENGINE */
+
+/* CELL_GENOME() is for reading, CELL_GENOME_W() gets a genome that can be
+ * written and CELL_SET_GENOME() stores an offspring genome (see
+ * copyGenome()). They only differ with the genome store. */
+#ifdef USE_GENOME_STORE
+#define CELL_GENOME(c) (CELL_GENOME_REF(c)->words)
+#define CELL_GENOME_W(c) genomeForWrite(&CELL_GENOME_REF(c),genomeCellStripe(c))
+#define CELL_SET_GENOME(c,src,used) (internGenome(&CELL_GENOME_REF(c),genomeCellStripe(c),(src),(used)),CELL_GENOME_HIGH(c) = (used))
+#else
+#define CELL_GENOME_W(c) CELL_GENOME(c)
+#define CELL_SET_GENOME(c,src,used) (copyGenome(CELL_GENOME(c),(src),(used),CELL_GENOME_HIGH(c)),CELL_GENOME_HIGH(c) = (used))
+#endif
+
+/* CELL_GENOME_HIGH() is a high-water mark: every word of a cell's genome
+ * from it on is all ~0 (STOPs). Offspring set it to the words of output
+ * buffer they used and seeding to the whole genome, and CELL_GENOME_TOUCH()
+ * must be done on every other write to a genome word. It's never lowered
+ * otherwise, so it can overestimate but never underestimate, and copies,
+ * hashes and dumps only have to look at that many words. */
+#define CELL_GENOME_TOUCH(c,w) do { if (CELL_GENOME_HIGH(c) <= (w)) CELL_GENOME_HIGH(c) = (w) + 1; } while (0)
+
+/* A cell that has never been written to, all zeros as the pond starts
+ * out, is empty: no energy, no parent and (with its high-water mark of
+ * zero) a genome of all STOPs. The words of its genome are zeros though,
+ * so CELL_MATERIALIZE() must be done before such a cell is given energy
+ * or written to as a neighbor: it fills the genome with actual STOPs. A
+ * cell needs that if it has a high-water mark of zero but a first word
+ * that isn't all STOPs. With the genome store cells instead start out
+ * sharing the empty genome, which is real. */
+#ifdef USE_GENOME_STORE
+#define CELL_MATERIALIZE(c) ((void)0)
+#else
+#define CELL_MATERIALIZE(c) do { if ((!CELL_GENOME_HIGH(c))&&(CELL_GENOME(c)[0] != ~((uintptr_t)0))) materializeCell(c); } while (0)
+
+static void materializeCell(const uintptr_t c)
+{
+	uintptr_t i;
+	for(i=0;i<POND_DEPTH_SYSWORDS;++i)
+		CELL_GENOME(c)[i] = ~((uintptr_t)0);
+	CELL_SYNC_LOGO(c);
+}
+#endif
+
+/*
+ * Cell locking
+ *
+ * Every cell lock is a sequence counter: it is odd while a thread holds
+ * the lock and is incremented again on release. Writers take the lock
+ * with a compare-and-swap and spin (or give up, see cellTryLock()) if it
+ * is held. Readers that only want a snapshot, such as getColor() and
+ * dumpCell(), never take the lock at all: they read the counter, read
+ * the cell, and retry if the counter was odd or changed meanwhile. The
+ * counter is 32 bits wide so it can't wrap back to the value a reader
+ * saw while that reader is still copying the cell.
+ *
+ * A thread holds the lock of the cell it is executing for the whole
+ * execution. Neighbors are only ever try-locked while holding that lock,
+ * so there is no lock ordering to get wrong and no way to deadlock. If a
+ * neighbor is busy the interaction with it simply doesn't happen, and a
+ * cell picked for execution while another thread holds it is skipped:
+ * that pick is lost rather than retried, which just gives one other cell
+ * the turn. Nothing counts these skips; they are rare unless a pond is
+ * very small for its thread count. A reader that finds a cell locked
+ * waits until it is released, which can take the whole execution of the
+ * cell (bounded by its energy) or the commit of an interaction.
+ */
+#ifdef USE_CELL_LOCKS
+
+#ifdef CELL_LOCK_STRIPES
+struct CACHE_ALIGNED CellLockStripe
+{
+	uint32_t seq;
+};
+static struct CellLockStripe cellLocks[CELL_LOCK_STRIPES];
+#define CELL_LOCK(c) (&(cellLocks[(c) & (CELL_LOCK_STRIPES - 1)].seq))
+#else
+static uint32_t *cellLocks; /* Allocated with the pond */
+#define CELL_LOCK(c) (&(cellLocks[(c)]))
+#endif /* CELL_LOCK_STRIPES */
+
+static inline int cellTryLock(const uintptr_t c)
+{
+	uint32_t seq = __atomic_load_n(CELL_LOCK(c),__ATOMIC_RELAXED);
+	return ((!(seq & 1))&&(__atomic_compare_exchange_n(CELL_LOCK(c),&seq,seq + 1,0,__ATOMIC_ACQUIRE,__ATOMIC_RELAXED)));
+}
+
+/* Returns true if another thread may hold the lock of cell c */
+static inline int cellLocked(const uintptr_t c)
+{
+	return (__atomic_load_n(CELL_LOCK(c),__ATOMIC_RELAXED) & 1);
+}
+
+static inline void cellLock(const uintptr_t c)
+{
+	uintptr_t spins = 0;
+	while (!cellTryLock(c))
+		spinBackoff(&spins);
+}
+
+static inline void cellUnlock(const uintptr_t c)
+{
+	__atomic_store_n(CELL_LOCK(c),__atomic_load_n(CELL_LOCK(c),__ATOMIC_RELAXED) + 1,__ATOMIC_RELEASE);
+}
+
+/* Try-locks a neighbor while the lock of cell is held */
+static inline int cellTryLockNeighbor(const uintptr_t cell,const uintptr_t nbr)
+{
+	return ((CELL_LOCK(cell) == CELL_LOCK(nbr))||(cellTryLock(nbr)));
+}
+
+static inline void cellUnlockNeighbor(const uintptr_t cell,const uintptr_t nbr)
+{
+	if (CELL_LOCK(cell) != CELL_LOCK(nbr))
+		cellUnlock(nbr);
+}
+
+/* Starts a snapshot read, waiting for any writer to finish */
+static inline uint32_t cellReadBegin(const uintptr_t c)
+{
+	uintptr_t spins = 0;
+	uint32_t seq;
+	while ((seq = __atomic_load_n(CELL_LOCK(c),__ATOMIC_ACQUIRE)) & 1)
+		spinBackoff(&spins);
+	return seq;
+}
+
+/* Returns true if a snapshot read must be retried */
+static inline int cellReadRetry(const uintptr_t c,const uint32_t seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return (__atomic_load_n(CELL_LOCK(c),__ATOMIC_RELAXED) != seq);
+}
+
+#else /* !USE_CELL_LOCKS */
+
+#define cellTryLock(c) 1
+#define cellLocked(c) 0
+#define cellLock(c) ((void)0)
+#define cellUnlock(c) ((void)0)
+#define cellTryLockNeighbor(cell,nbr) ((void)(cell),(void)(nbr),1)
+#define cellUnlockNeighbor(cell,nbr) ((void)(cell),(void)(nbr))
+#define cellReadBegin(c) 0
+#define cellReadRetry(c,seq) ((void)(seq),0)
+
+#endif /* USE_CELL_LOCKS */
+
+/* This is used to generate unique cell IDs */
+static volatile uint64_t cellIdCounter = 0;
+
+/* Currently selected color scheme */
+enum { KINSHIP,LINEAGE,MAX_COLOR_SCHEME } colorScheme = KINSHIP;
+
+#if defined(USE_SDL) || defined(USE_CONTROL)
+static const char *colorSchemeName[2] = { "KINSHIP", "LINEAGE" };
+#endif
+#ifdef USE_SDL
+static SDL_Window *window;
+static SDL_Surface *winsurf;
+static SDL_Surface *screen;
+#endif
+
+/* Neighbor interactions that take a lock, as profiled by lockNeighbor() */
+#define PROFILE_KILL 0
+#define PROFILE_SHARE 1
+#define PROFILE_OFFSPRING 2
+#define PROFILE_SITES 3
+
+#ifdef USE_PROFILING
+/* Instructions per cell execution are counted in power of two buckets:
+ * bucket 0 is none, bucket b holds 2^(b-1) up to 2^b - 1 and the last
+ * one everything from there on. */
+#define PROFILE_BUCKETS 16
+
+/* Extra counters kept when profiling, all uint64_t so they can be added
+ * up and subtracted as an array */
+struct ProfileCounters
+{
+	/* Cell executions profiled (those with energy) and their cycles */
+	uint64_t executions;
+	uint64_t cycles;
+
+	/* Executions by instructions executed */
+	uint64_t instructions[PROFILE_BUCKETS];
+
+	/* False LOOPs and instructions skipped in them */
+	uint64_t falseLoops;
+	uint64_t falseLoopSkipped;
+
+	/* Neighbor lock attempts, failures and cycles spent in them */
+	uint64_t lockAttempts[PROFILE_SITES];
+	uint64_t lockFailures[PROFILE_SITES];
+	uint64_t lockCycles[PROFILE_SITES];
+
+	/* Neighbor loads timed and those that missed the cache */
+	uint64_t neighborLoads;
+	uint64_t neighborMisses;
+};
+
+#define PROFILE_COUNTERS (sizeof(struct ProfileCounters) / sizeof(uint64_t))
+
+/* Evaluates to its argument only when profiling */
+#define PROFILE(x) x
+#else
+#define PROFILE(x)
+#endif /* USE_PROFILING */
+
+/**
+ * Per-thread statistics counters
+ *
+ * Each thread only ever increments its own block, which is padded to a
+ * cache line so that counting is free of false sharing and lost updates.
+ * Counters only go up; doReport() merges all blocks and subtracts the
+ * totals it saw at the previous report to get per-report numbers.
+ */
+struct CACHE_ALIGNED StatCounters
+{
+	/* Counts for the number of times each instruction was
+	 * executed. */
+	uint64_t instructionExecutions[16];
 	
-	uintptr_t x,y;
+	/* Number of cells executed */
+	uint64_t cellExecutions;
 	
-	uint64_t totalActiveCells = 0;
-	uint64_t totalEnergy = 0;
-	uint64_t totalViableReplicators = 0;
-	uintptr_t maxGeneration = 0;
+	/* Number of viable cells replaced by other cells' offspring */
+	uint64_t viableCellsReplaced;
 	
-	for(x=0;x<POND_SIZE_X;++x) {
-		for(y=0;y<POND_SIZE_Y;++y) {
-			struct Cell *const c = &pond[x][y];
-			if (c->energy) {
-				++totalActiveCells;
-				totalEnergy += (uint64_t)c->energy;
-				if (c->generation > 2)
-					++totalViableReplicators;
-				if (c->generation > maxGeneration)
-					maxGeneration = c->generation;
-			}
+	/* Number of viable cells KILLed */
+	uint64_t viableCellsKilled;
+	
+	/* Number of successful SHARE operations */
+	uint64_t viableCellShares;
+
+#ifdef USE_INCREMENTAL_STATS
+	/* Changes this thread has made to the pond totals */
+	int64_t energyDelta;
+	int64_t activeCellsDelta;
+	int64_t viableReplicatorsDelta;
+
+	/* Highest generation this thread has seen a cell with energy reach */
+	uint64_t maxGeneration;
+#endif
+
+#ifdef USE_PROFILING
+	struct ProfileCounters prof;
+#endif
+};
+
+static struct StatCounters *statCounters;
+
+/* Adds one set of stat counters to another */
+static void addStatCounters(struct StatCounters *const sum,const volatile struct StatCounters *const sc)
+{
+	uintptr_t i;
+	for(i=0;i<16;++i)
+		sum->instructionExecutions[i] += sc->instructionExecutions[i];
+	sum->cellExecutions += sc->cellExecutions;
+	sum->viableCellsReplaced += sc->viableCellsReplaced;
+	sum->viableCellsKilled += sc->viableCellsKilled;
+	sum->viableCellShares += sc->viableCellShares;
+#ifdef USE_INCREMENTAL_STATS
+	sum->energyDelta += sc->energyDelta;
+	sum->activeCellsDelta += sc->activeCellsDelta;
+	sum->viableReplicatorsDelta += sc->viableReplicatorsDelta;
+	if (sc->maxGeneration > sum->maxGeneration)
+		sum->maxGeneration = sc->maxGeneration;
+#endif
+#ifdef USE_PROFILING
+	for(i=0;i<PROFILE_COUNTERS;++i)
+		((uint64_t *)&sum->prof)[i] += ((const volatile uint64_t *)&sc->prof)[i];
+#endif
+}
+
+/**
+ * Accounts for a change to a cell's energy and/or generation
+ *
+ * This must be called with the cell locked and before the change is
+ * made. It compiles to nothing without USE_INCREMENTAL_STATS.
+ *
+ * @param stats Counters of thread making the change
+ * @param oldEnergy Energy before
+ * @param oldGeneration Generation before
+ * @param newEnergy Energy after
+ * @param newGeneration Generation after
+ */
+static inline void accountCell(struct StatCounters *const stats,const uintptr_t oldEnergy,const uintptr_t oldGeneration,const uintptr_t newEnergy,const uintptr_t newGeneration)
+{
+#ifdef USE_INCREMENTAL_STATS
+	stats->energyDelta += (int64_t)newEnergy - (int64_t)oldEnergy;
+	stats->activeCellsDelta += (int64_t)(newEnergy != 0) - (int64_t)(oldEnergy != 0);
+	stats->viableReplicatorsDelta += (int64_t)((newEnergy != 0)&&(newGeneration > 2)) - (int64_t)((oldEnergy != 0)&&(oldGeneration > 2));
+	if ((newEnergy)&&(newGeneration > stats->maxGeneration))
+		stats->maxGeneration = newGeneration;
+#else
+	(void)stats;
+	(void)oldEnergy;
+	(void)oldGeneration;
+	(void)newEnergy;
+	(void)newGeneration;
+#endif
+}
+
+/* Reads the time stamp counter, or gives 0 if there isn't one */
+static inline uint64_t getCycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return (uint64_t)__builtin_ia32_rdtsc();
+#else
+	return 0;
+#endif
+}
+
+#ifdef USE_PROFILING
+/* Times a single load, fenced so that nothing else is timed with it */
+static inline uint64_t timeLoad(const volatile uintptr_t *const p)
+{
+#if defined(__x86_64__) || defined(__SSE2__)
+	uint64_t start;
+	__builtin_ia32_lfence();
+	start = __builtin_ia32_rdtsc();
+	__builtin_ia32_lfence();
+	(void)*p;
+	__builtin_ia32_lfence();
+	return __builtin_ia32_rdtsc() - start;
+#else
+	(void)*p;
+	return 0;
+#endif
+}
+
+/* Counts a cell execution that took cycles and ran instructions */
+static inline void profileExecution(struct StatCounters *const stats,const uint64_t cycles,const uintptr_t instructions)
+{
+	uintptr_t b = instructions ? (uintptr_t)(64 - __builtin_clzll((unsigned long long)instructions)) : 0;
+	if (b >= PROFILE_BUCKETS)
+		b = PROFILE_BUCKETS - 1;
+	++stats->prof.executions;
+	stats->prof.cycles += cycles;
+	++stats->prof.instructions[b];
+}
+#endif /* USE_PROFILING */
+
+/**
+ * Try-locks a neighbor to interact with it
+ *
+ * This is cellTryLockNeighbor(), but when profiling the neighbor's energy
+ * is first loaded and timed to see if it was in cache, and the lock
+ * attempt is timed and counted for the interaction it's for.
+ *
+ * @param stats Counters of the executing thread
+ * @param site Interaction, one of the PROFILE_ sites
+ * @param cell Cell executing, which is locked
+ * @param nbr Neighbor
+ * @return Nonzero if the neighbor was locked
+ */
+static inline int lockNeighbor(struct StatCounters *const stats,const uintptr_t site,const uintptr_t cell,const uintptr_t nbr)
+{
+#ifdef USE_PROFILING
+	uint64_t start;
+	int locked;
+	++stats->prof.neighborLoads;
+	if (timeLoad(&CELL_ENERGY(nbr)) >= PROFILE_MISS_CYCLES)
+		++stats->prof.neighborMisses;
+	start = getCycles();
+	locked = cellTryLockNeighbor(cell,nbr);
+	stats->prof.lockCycles[site] += getCycles() - start;
+	++stats->prof.lockAttempts[site];
+	if (!locked)
+		++stats->prof.lockFailures[site];
+	return locked;
+#else
+	(void)stats;
+	(void)site;
+	return cellTryLockNeighbor(cell,nbr);
+#endif
+}
+
+/**
+ * Sums all threads' stat counters
+ *
+ * Counters are read through a volatile pointer while their owners keep
+ * incrementing them. This assumes an LP64 target, where the 64-bit
+ * counters are loaded and stored whole and each value read is one its
+ * owner actually stored. On a 32-bit target a counter can be read half
+ * way through a carry into its upper word, which throws off the numbers
+ * of one report (the next one makes up for it, as totals only go up).
+ *
+ * @param sum Destination for totals
+ */
+static void sumStatCounters(struct StatCounters *const sum)
+{
+	uintptr_t t;
+	memset(sum,0,sizeof(struct StatCounters));
+	for(t=0;t<threadCount;++t)
+		addStatCounters(sum,&statCounters[t]);
+}
+
+/* Monotonic wall clock time in seconds */
+static double getSeconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (double)ts.tv_sec + ((double)ts.tv_nsec / 1000000000.0);
+}
+
+#ifdef BENCHMARK_TICKS
+/* Time spent in and number of full-pond scans in doReport() */
+static double benchReportScanSeconds = 0.0;
+static uint64_t benchReportScans = 0;
+#endif
+
+/* Totals over the whole pond shown in reports */
+struct PondTotals
+{
+	uint64_t energy;
+	uint64_t activeCells;
+	uint64_t viableReplicators;
+	uint64_t maxGeneration;
+};
+
+/* Scans the whole pond to get its totals, which are only approximate if
+ * other threads are running (see the reporter thread) */
+static void scanPond(struct PondTotals *const pt)
+{
+	uint64_t energy = 0,activeCells = 0,viableReplicators = 0,maxGeneration = 0;
+	uintptr_t c;
+	/* With the GPU engine this runs where the pond is */
+#ifdef USE_GPU_ENGINE
+#pragma omp target teams distribute parallel for if(gpuPondOnDevice) map(tofrom:energy,activeCells,viableReplicators,maxGeneration) reduction(+:energy,activeCells,viableReplicators) reduction(max:maxGeneration)
+#endif
+	for(c=POND_OWNED_BEGIN;c<POND_OWNED_END;++c) {
+		if (CELL_ENERGY(c)) {
+			++activeCells;
+			energy += (uint64_t)CELL_ENERGY(c);
+			if (CELL_GENERATION(c) > 2)
+				++viableReplicators;
+			if (CELL_GENERATION(c) > maxGeneration)
+				maxGeneration = CELL_GENERATION(c);
 		}
 	}
+	pt->energy = energy;
+	pt->activeCells = activeCells;
+	pt->viableReplicators = viableReplicators;
+	pt->maxGeneration = maxGeneration;
+}
+
+#ifdef USE_INCREMENTAL_STATS
+/* Pond totals at startup, which the threads' deltas are relative to */
+static struct PondTotals pondBase;
+#endif
+
+#ifdef USE_MPI
+/**
+ * Sums a report over all ranks into rank 0
+ *
+ * Every rank reports at the same clock between the same two phases, so
+ * this is a plain reduction.
+ *
+ * @param pt Totals of this rank's strip, replaced by those of the pond on rank 0
+ * @param epoch Counters of this rank, likewise
+ * @return Nonzero on rank 0, which prints the report
+ */
+static int reduceReport(struct PondTotals *const pt,struct StatCounters *const epoch)
+{
+	uint64_t v[24],sum[24],maxGeneration = 0;
+	uintptr_t i,n = 0;
+
+	v[n++] = pt->energy;
+	v[n++] = pt->activeCells;
+	v[n++] = pt->viableReplicators;
+	v[n++] = epoch->cellExecutions;
+	v[n++] = epoch->viableCellsReplaced;
+	v[n++] = epoch->viableCellsKilled;
+	v[n++] = epoch->viableCellShares;
+	for(i=0;i<16;++i)
+		v[n++] = epoch->instructionExecutions[i];
+	MPI_Reduce(v,sum,(int)n,MPI_UINT64_T,MPI_SUM,0,MPI_COMM_WORLD);
+	MPI_Reduce(&pt->maxGeneration,&maxGeneration,1,MPI_UINT64_T,MPI_MAX,0,MPI_COMM_WORLD);
+#ifdef USE_PROFILING
+	{
+		struct ProfileCounters prof;
+		MPI_Reduce(&epoch->prof,&prof,(int)PROFILE_COUNTERS,MPI_UINT64_T,MPI_SUM,0,MPI_COMM_WORLD);
+		epoch->prof = prof;
+	}
+#endif
+	if (mpiRank)
+		return 0;
+
+	n = 0;
+	pt->energy = sum[n++];
+	pt->activeCells = sum[n++];
+	pt->viableReplicators = sum[n++];
+	epoch->cellExecutions = sum[n++];
+	epoch->viableCellsReplaced = sum[n++];
+	epoch->viableCellsKilled = sum[n++];
+	epoch->viableCellShares = sum[n++];
+	for(i=0;i<16;++i)
+		epoch->instructionExecutions[i] = sum[n++];
+	pt->maxGeneration = maxGeneration;
+	return 1;
+}
+#endif /* USE_MPI */
+
+/* Room for a line of CSV output */
+#define REPORT_LINE_SIZE 2048
+
+#ifdef USE_CONTROL
+/*
+ * The last REPORT_LINES report lines, for the control thread to stream
+ * to clients. doReport() only copies each line in and bumps the count,
+ * so reporting never waits on a client. The control thread copies lines
+ * out and then checks the count to see if one was overwritten while it
+ * was copying, so a client that falls that far behind misses lines.
+ */
+#define REPORT_LINES 16
+
+static char reportLines[REPORT_LINES][REPORT_LINE_SIZE];
+static uintptr_t reportLineLengths[REPORT_LINES];
+static uint64_t reportLineCount = 0;
+
+/* Called by whichever thread reports, which is only ever one */
+static void publishReport(const char *const line,const uintptr_t n)
+{
+	const uint64_t i = __atomic_load_n(&reportLineCount,__ATOMIC_RELAXED);
+	memcpy(reportLines[i % REPORT_LINES],line,n);
+	reportLineLengths[i % REPORT_LINES] = n;
+	__atomic_store_n(&reportLineCount,i + 1,__ATOMIC_RELEASE);
+}
+#endif /* USE_CONTROL */
+
+/**
+ * Prints a line of CSV output
+ *
+ * @param clock Clock to report
+ * @param totals Merged stat counters, see sumStatCounters()
+ */
+static void doReport(const uint64_t clock,const struct StatCounters *const totals)
+{
+	static uint64_t lastTotalViableReplicators = 0;
+	static struct StatCounters lastStatTotals;
+	
+	uintptr_t x;
+	
+	struct PondTotals pt;
+	
+	struct StatCounters epoch;
+
+	/* The line is built here and written out in one go */
+	char line[REPORT_LINE_SIZE];
+	int n;
+	
+	/* Take the difference from the last report, which is the same as
+	 * resetting the counters every report. */
+	for(x=0;x<16;++x)
+		epoch.instructionExecutions[x] = totals->instructionExecutions[x] - lastStatTotals.instructionExecutions[x];
+	epoch.cellExecutions = totals->cellExecutions - lastStatTotals.cellExecutions;
+	epoch.viableCellsReplaced = totals->viableCellsReplaced - lastStatTotals.viableCellsReplaced;
+	epoch.viableCellsKilled = totals->viableCellsKilled - lastStatTotals.viableCellsKilled;
+	epoch.viableCellShares = totals->viableCellShares - lastStatTotals.viableCellShares;
+#ifdef USE_PROFILING
+	for(x=0;x<PROFILE_COUNTERS;++x)
+		((uint64_t *)&epoch.prof)[x] = ((const uint64_t *)&totals->prof)[x] - ((const uint64_t *)&lastStatTotals.prof)[x];
+#endif
+	lastStatTotals = *totals;
+	
+#ifdef BENCHMARK_TICKS
+	const double scanStart = getSeconds();
+#endif
+#ifdef USE_INCREMENTAL_STATS
+	pt.energy = pondBase.energy + (uint64_t)totals->energyDelta;
+	pt.activeCells = pondBase.activeCells + (uint64_t)totals->activeCellsDelta;
+	pt.viableReplicators = pondBase.viableReplicators + (uint64_t)totals->viableReplicatorsDelta;
+	pt.maxGeneration = (totals->maxGeneration > pondBase.maxGeneration) ? totals->maxGeneration : pondBase.maxGeneration;
+#else
+	scanPond(&pt);
+#endif
+#ifdef BENCHMARK_TICKS
+	benchReportScanSeconds += getSeconds() - scanStart;
+	++benchReportScans;
+#endif
+#ifdef USE_MPI
+	if (!reduceReport(&pt,&epoch))
+		return;
+#endif
 	
 	/* Look here to get the columns in the CSV output */
 	
 	/* The first five are here and are self-explanatory */
-	printf("%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu",
-		(uint64_t)clock,
-		(uint64_t)totalEnergy,
-		(uint64_t)totalActiveCells,
-		(uint64_t)totalViableReplicators,
-		(uint64_t)maxGeneration,
-		(uint64_t)statCounters.viableCellsReplaced,
-		(uint64_t)statCounters.viableCellsKilled,
-		(uint64_t)statCounters.viableCellShares
+	n = snprintf(line,sizeof(line),"%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu",
+		(unsigned long long)clock,
+		(unsigned long long)pt.energy,
+		(unsigned long long)pt.activeCells,
+		(unsigned long long)pt.viableReplicators,
+		(unsigned long long)pt.maxGeneration,
+		(unsigned long long)epoch.viableCellsReplaced,
+		(unsigned long long)epoch.viableCellsKilled,
+		(unsigned long long)epoch.viableCellShares
 		);
 	
 	/* The next 16 are the average frequencies of execution for each
 	 * instruction per cell execution. */
-	double totalMetabolism = 0.0;
+	uint64_t totalMetabolism = 0;
 	for(x=0;x<16;++x) {
-		totalMetabolism += statCounters.instructionExecutions[x];
-		printf(",%.4f",(statCounters.cellExecutions > 0.0) ? (statCounters.instructionExecutions[x] / statCounters.cellExecutions) : 0.0);
+		totalMetabolism += epoch.instructionExecutions[x];
+		n += snprintf(line + n,sizeof(line) - n,",%.4f",(epoch.cellExecutions > 0) ? ((double)epoch.instructionExecutions[x] / (double)epoch.cellExecutions) : 0.0);
 	}
 	
 	/* The last column is the average metabolism per cell execution */
-	printf(",%.4f\n",(statCounters.cellExecutions > 0.0) ? (totalMetabolism / statCounters.cellExecutions) : 0.0);
+	n += snprintf(line + n,sizeof(line) - n,",%.4f",(epoch.cellExecutions > 0) ? ((double)totalMetabolism / (double)epoch.cellExecutions) : 0.0);
+
+#ifdef USE_PROFILING
+	/* When profiling these follow, all over profiled cell executions
+	 * (those that had energy): cycles per execution, the fraction of
+	 * executions in each instruction count bucket, false LOOPs per
+	 * execution, instructions skipped per false LOOP, then for KILL,
+	 * SHARE and offspring the fraction of neighbor locks that failed and
+	 * cycles per lock attempt, and last the neighbor cache miss rate. */
+#define PROFILE_RATIO(a,b) (((b) > 0) ? ((double)(a) / (double)(b)) : 0.0)
+	n += snprintf(line + n,sizeof(line) - n,",%.1f",PROFILE_RATIO(epoch.prof.cycles,epoch.prof.executions));
+	for(x=0;x<PROFILE_BUCKETS;++x)
+		n += snprintf(line + n,sizeof(line) - n,",%.4f",PROFILE_RATIO(epoch.prof.instructions[x],epoch.prof.executions));
+	n += snprintf(line + n,sizeof(line) - n,",%.4f,%.2f",PROFILE_RATIO(epoch.prof.falseLoops,epoch.prof.executions),PROFILE_RATIO(epoch.prof.falseLoopSkipped,epoch.prof.falseLoops));
+	for(x=0;x<PROFILE_SITES;++x)
+		n += snprintf(line + n,sizeof(line) - n,",%.4f,%.1f",PROFILE_RATIO(epoch.prof.lockFailures[x],epoch.prof.lockAttempts[x]),PROFILE_RATIO(epoch.prof.lockCycles[x],epoch.prof.lockAttempts[x]));
+	n += snprintf(line + n,sizeof(line) - n,",%.4f",PROFILE_RATIO(epoch.prof.neighborMisses,epoch.prof.neighborLoads));
+#undef PROFILE_RATIO
+#endif
+
+	line[n++] = '\n';
+	fwrite(line,1,(size_t)n,stdout);
 	fflush(stdout);
+#ifdef USE_CONTROL
+	publishReport(line,(uintptr_t)n);
+#endif
 	
-	if ((lastTotalViableReplicators > 0)&&(totalViableReplicators == 0))
+	if ((lastTotalViableReplicators > 0)&&(pt.viableReplicators == 0))
 		fprintf(stderr,"[EVENT] Viable replicators have gone extinct. Please reserve a moment of silence.\n");
-	else if ((lastTotalViableReplicators == 0)&&(totalViableReplicators > 0))
+	else if ((lastTotalViableReplicators == 0)&&(pt.viableReplicators > 0))
 		fprintf(stderr,"[EVENT] Viable replicators have appeared!\n");
 	
-	lastTotalViableReplicators = totalViableReplicators;
-	
-	/* Reset per-report stat counters */
-	for(x=0;x<sizeof(statCounters);++x)
-		((uint8_t *)&statCounters)[x] = (uint8_t)0;
+	lastTotalViableReplicators = pt.viableReplicators;
 }
 
 /**
- * Dumps the genome of a cell to a file.
+ * Gets the length of a genome in instructions, logo included
  *
- * @param file Destination
- * @param cell Source
- */
-static void dumpCell(FILE *file, struct Cell *cell)
-{
-	uintptr_t wordPtr,shiftPtr,inst,stopCount,i;
-
-	if (cell->energy&&(cell->generation > 2)) {
-		wordPtr = 0;
-		shiftPtr = 0;
-		stopCount = 0;
-		for(i=0;i<POND_DEPTH;++i) {
-			inst = (cell->genome[wordPtr] >> shiftPtr) & 0xf;
-			/* Four STOP instructions in a row is considered the end.
-			 * The probability of this being wrong is *very* small, and
-			 * could only occur if you had four STOPs in a row inside
-			 * a LOOP/REP pair that's always false. In any case, this
-			 * would always result in our *underestimating* the size of
-			 * the genome and would never result in an overestimation. */
-			fprintf(file,"%x",(unsigned int)inst);
-			if (inst == 0xf) { /* STOP */
-				if (++stopCount >= 4)
-					break;
-			} else stopCount = 0;
-			if ((shiftPtr += 4) >= SYSWORD_BITS) {
-				if (++wordPtr >= POND_DEPTH_SYSWORDS) {
-					wordPtr = EXEC_START_WORD;
-					shiftPtr = EXEC_START_BIT;
-				} else shiftPtr = 0;
-			}
-		}
+ * Four STOP instructions in a row is considered the end, and they are
+ * counted as part of the genome. The probability of this being wrong is
+ * *very* small, and could only occur if you had four STOPs in a row
+ * inside a LOOP/REP pair that's always false. In any case, this would
+ * always result in our *underestimating* the size of the genome and
+ * would never result in an overestimation.
+ *
+ * @param genome Genome, as read by readGenome()
+ * @param words Words of genome that were read
+ */
+static uintptr_t genomeLength(const uintptr_t *const genome,const uintptr_t words)
+{
+	uintptr_t i,inst,stopCount = 0;
+	for(i=0;i<(words * SYSWORD_NIBBLES);) {
+		inst = (genome[i / SYSWORD_NIBBLES] >> ((i % SYSWORD_NIBBLES) * 4)) & 0xf;
+		++i;
+		if (inst == 0xf) { /* STOP */
+			if (++stopCount >= 4)
+				break;
+		} else stopCount = 0;
 	}
-	fprintf(file,"\n");
+	return i;
 }
 
-static inline struct Cell *getNeighbor(const uintptr_t x,const uintptr_t y,const uintptr_t dir)
+/**
+ * Copies the live part of a cell's genome
+ *
+ * That's the words below CELL_GENOME_HIGH() and one all ~0 word after
+ * them if there's room, which is enough for genomeLength() to find its
+ * four STOPs. This is done inside snapshot reads, so the high-water mark
+ * may be torn and is clamped.
+ *
+ * @param genome Destination with room for POND_DEPTH_SYSWORDS words
+ * @param cell Source cell index
+ * @return Words copied
+ */
+static inline uintptr_t readGenome(uintptr_t *const genome,const uintptr_t cell)
 {
-	/* Space is toroidal; it wraps at edges */
-	switch(dir) {
-		case N_LEFT:
-			return (x) ? &pond[x-1][y] : &pond[POND_SIZE_X-1][y];
-		case N_RIGHT:
-			return (x < (POND_SIZE_X-1)) ? &pond[x+1][y] : &pond[0][y];
-		case N_UP:
-			return (y) ? &pond[x][y-1] : &pond[x][POND_SIZE_Y-1];
-		case N_DOWN:
-			return (y < (POND_SIZE_Y-1)) ? &pond[x][y+1] : &pond[x][0];
-	}
-	return &pond[x][y]; /* This should never be reached */
+	uintptr_t i,high = (uintptr_t)CELL_GENOME_HIGH(cell);
+	if (high > POND_DEPTH_SYSWORDS)
+		high = POND_DEPTH_SYSWORDS;
+	for(i=0;i<high;++i)
+		genome[i] = CELL_GENOME(cell)[i];
+	if (high < POND_DEPTH_SYSWORDS)
+		genome[high++] = ~((uintptr_t)0);
+	return high;
 }
 
-static inline int accessAllowed(struct Cell *const c2,const uintptr_t c1guess,int sense)
+#if defined(USE_SDL) || defined(USE_CONTROL)
+/**
+ * Dumps the genome of a cell to a file.
+ *
+ * @param file Destination
+ * @param cell Source cell index
+ */
+static void dumpCell(FILE *file, const uintptr_t cell)
 {
-	/* Access permission is more probable if they are more similar in sense 0,
-	 * and more probable if they are different in sense 1. Sense 0 is used for
-	 * "negative" interactions and sense 1 for "positive" ones. */
-	return sense ? (((getRandom() & 0xf) >= BITS_IN_FOURBIT_WORD[(c2->genome[0] & 0xf) ^ (c1guess & 0xf)])||(!c2->parentID)) : (((getRandom() & 0xf) <= BITS_IN_FOURBIT_WORD[(c2->genome[0] & 0xf) ^ (c1guess & 0xf)])||(!c2->parentID));
+	uintptr_t i,words,length,energy,generation;
+	uintptr_t genome[POND_DEPTH_SYSWORDS];
+	uint32_t seq;
+
+	/* Take a consistent snapshot first so we never print a genome that
+	 * is being overwritten while we're writing it out. */
+	do {
+		seq = cellReadBegin(cell);
+		energy = CELL_ENERGY(cell);
+		generation = CELL_GENERATION(cell);
+		words = readGenome(genome,cell);
+	} while (cellReadRetry(cell,seq));
+
+	if (energy&&(generation > 2)) {
+		length = genomeLength(genome,words);
+		for(i=0;i<length;++i)
+			fprintf(file,"%x",(unsigned int)((genome[i / SYSWORD_NIBBLES] >> ((i % SYSWORD_NIBBLES) * 4)) & 0xf));
+	}
+	fprintf(file,"\n");
 }
+#endif /* USE_SDL || USE_CONTROL */
+
+/*
+ * Genome census
+ *
+ * Every censusFrequency reports, thread 0 collects the genomes of all
+ * viable replicators, trimmed by genomeLength(), and counts identical
+ * ones using a hash table. A writer thread then streams them out as
+ * "count,genome" lines, most common first, to a file named after the
+ * census prefix and the clock. The writer does the formatting and
+ * compression, which are the slow part, while cells keep running. If it
+ * is still busy with the last census a new one is skipped.
+ */
 
-static inline uint8_t getColor(struct Cell *c)
+struct CensusEntry
 {
-	uintptr_t i,j,word,sum,opcode,skipnext;
+	uint64_t hash;
+	uintptr_t length; /* In instructions */
+	uintptr_t count;
+	uintptr_t words; /* Index of genome in Census.genomes */
+};
 
-	if (c->energy) {
-		switch(colorScheme) {
-			case KINSHIP:
-				/*
-				 * Kinship color scheme by Christoph Groth
-				 *
-				 * For cells of generation > 1, saturation and value are set to maximum.
-				 * Hue is a hash-value with the property that related genomes will have
-				 * similar hue (but of course, as this is a hash function, totally
-				 * different genomes can also have a similar or even the same hue).
+struct Census
+{
+	uint64_t clock;
+
+	/* Distinct genomes seen */
+	struct CensusEntry *entries;
+	uintptr_t entryCount;
+	uintptr_t entryCapacity;
+
+	/* Trimmed genomes, packed the same way as in cells */
+	uintptr_t *genomes;
+	uintptr_t wordCount;
+	uintptr_t wordCapacity;
+
+	/* Open addressed hash table of entries (index + 1, or 0 if empty) */
+	uintptr_t *table;
+	uintptr_t tableSize;
+};
+
+static struct Census census;
+
+/* File name prefix for censuses, or null for none */
+static const char *censusPrefix = (const char *)0;
+
+#ifdef USE_PTHREADS_COUNT
+static pthread_mutex_t censusLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t censusCond = PTHREAD_COND_INITIALIZER;
+static pthread_t censusThread;
+static int censusThreadRunning = 0;
+static int censusExit = 0;
+#endif
+
+/* Nonzero while the writer owns census */
+static int censusPending = 0;
+
+#ifdef USE_ZLIB
+#define CENSUS_SUFFIX ".gz"
+typedef gzFile CensusFile;
+#define censusOpen(path) gzopen((path),"wb")
+#define censusWrite(f,buf,len) (gzwrite((f),(buf),(unsigned int)(len)) == (int)(len))
+#define censusClose(f) (gzclose(f) == Z_OK)
+#else
+#define CENSUS_SUFFIX ".txt"
+typedef FILE *CensusFile;
+#define censusOpen(path) fopen((path),"wb")
+#define censusWrite(f,buf,len) (fwrite((buf),1,(len),(f)) == (len))
+#define censusClose(f) (fclose(f) == 0)
+#endif
+
+static void *growArray(void *p,uintptr_t *const capacity,const uintptr_t needed,const size_t size)
+{
+	uintptr_t c = *capacity;
+	if (needed <= c)
+		return p;
+	while (c < needed)
+		c = c ? (c * 2) : 1024;
+	p = realloc(p,c * size);
+	if (!p) {
+		fprintf(stderr,"*** Out of memory ***\n");
+		exit(1);
+	}
+	*capacity = c;
+	return p;
+}
+
+/* Adds a trimmed genome (with unused bits of its last word zeroed) */
+static void censusAdd(const uintptr_t *const genome,const uintptr_t length)
+{
+	const uintptr_t words = (length + SYSWORD_NIBBLES - 1) / SYSWORD_NIBBLES;
+	uint64_t h = (uint64_t)length * 0x9e3779b97f4a7c15ULL;
+	uintptr_t i,slot;
+	struct CensusEntry *e;
+
+	for(i=0;i<words;++i) {
+		h = (h ^ (uint64_t)genome[i]) * 0xbf58476d1ce4e5b9ULL;
+		h ^= h >> 31;
+	}
+
+	slot = (uintptr_t)h & (census.tableSize - 1);
+	while (census.table[slot]) {
+		e = &census.entries[census.table[slot] - 1];
+		if ((e->hash == h)&&(e->length == length)&&(!memcmp(census.genomes + e->words,genome,words * sizeof(uintptr_t)))) {
+			++e->count;
+			return;
+		}
+		slot = (slot + 1) & (census.tableSize - 1);
+	}
+
+	census.entries = (struct CensusEntry *)growArray(census.entries,&census.entryCapacity,census.entryCount + 1,sizeof(struct CensusEntry));
+	census.genomes = (uintptr_t *)growArray(census.genomes,&census.wordCapacity,census.wordCount + words,sizeof(uintptr_t));
+	e = &census.entries[census.entryCount++];
+	e->hash = h;
+	e->length = length;
+	e->count = 1;
+	e->words = census.wordCount;
+	memcpy(census.genomes + census.wordCount,genome,words * sizeof(uintptr_t));
+	census.wordCount += words;
+	census.table[slot] = census.entryCount;
+}
+
+/* Collects the genomes of all viable replicators into census */
+static void collectCensus(const uint64_t clock)
+{
+	uintptr_t genome[POND_DEPTH_SYSWORDS];
+	uintptr_t c,words,length,energy,generation;
+	uint32_t seq;
+
+	/* At most every cell is distinct, and the table is kept at most half
+	 * full */
+	if (!census.table) {
+		for(census.tableSize=1;census.tableSize<(POND_SIZE * 2);census.tableSize<<=1);
+		census.table = (uintptr_t *)allocPondMemory(sizeof(uintptr_t) * census.tableSize);
+	} else memset(census.table,0,sizeof(uintptr_t) * census.tableSize);
+	census.clock = clock;
+	census.entryCount = 0;
+	census.wordCount = 0;
+
+	for(c=POND_OWNED_BEGIN;c<POND_OWNED_END;++c) {
+		if ((!CELL_ENERGY(c))||(CELL_GENERATION(c) <= 2))
+			continue;
+		do {
+			seq = cellReadBegin(c);
+			energy = CELL_ENERGY(c);
+			generation = CELL_GENERATION(c);
+			words = readGenome(genome,c);
+		} while (cellReadRetry(c,seq));
+		if ((!energy)||(generation <= 2))
+			continue;
+		length = genomeLength(genome,words);
+		if (length % SYSWORD_NIBBLES)
+			genome[length / SYSWORD_NIBBLES] &= (((uintptr_t)1) << ((length % SYSWORD_NIBBLES) * 4)) - 1;
+		censusAdd(genome,length);
+	}
+}
+
+/* Most common first, then in the order first seen */
+static int compareCensusEntries(const void *a,const void *b)
+{
+	const struct CensusEntry *const ea = (const struct CensusEntry *)a;
+	const struct CensusEntry *const eb = (const struct CensusEntry *)b;
+	if (ea->count != eb->count)
+		return (ea->count > eb->count) ? -1 : 1;
+	return (ea->words < eb->words) ? -1 : ((ea->words > eb->words) ? 1 : 0);
+}
+
+/* Writes out census, returning zero on failure */
+static int writeCensus()
+{
+	static const char hexDigits[16] = { '0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f' };
+	char path[4096];
+	char buf[65536 + POND_DEPTH + 32];
+	uintptr_t i,j,n = 0;
+	const struct CensusEntry *e;
+	const uintptr_t *genome;
+	CensusFile f;
+	int ok = 1;
+
+	snprintf(path,sizeof(path),"%s%llu" CENSUS_SUFFIX,censusPrefix,(unsigned long long)census.clock);
+	f = censusOpen(path);
+	if (!f)
+		return 0;
+
+	qsort(census.entries,census.entryCount,sizeof(struct CensusEntry),compareCensusEntries);
+	for(i=0;(ok)&&(i<census.entryCount);++i) {
+		e = &census.entries[i];
+		genome = census.genomes + e->words;
+		n += (uintptr_t)snprintf(buf + n,32,"%llu,",(unsigned long long)e->count);
+		for(j=0;j<e->length;++j)
+			buf[n++] = hexDigits[(genome[j / SYSWORD_NIBBLES] >> ((j % SYSWORD_NIBBLES) * 4)) & 0xf];
+		buf[n++] = '\n';
+		if (n >= 65536) {
+			ok = censusWrite(f,buf,n);
+			n = 0;
+		}
+	}
+	if ((ok)&&(n))
+		ok = censusWrite(f,buf,n);
+	if (!censusClose(f))
+		ok = 0;
+	return ok;
+}
+
+#ifdef USE_PTHREADS_COUNT
+static void *censusWriter(void *arg)
+{
+	(void)arg;
+#ifdef USE_NUMA
+	/* Don't stay pinned to thread 0's CPU that this was started from */
+	pthread_setaffinity_np(pthread_self(),sizeof(numaCpus),&numaCpus);
+#endif
+	pthread_mutex_lock(&censusLock);
+	for(;;) {
+		while ((!censusPending)&&(!censusExit))
+			pthread_cond_wait(&censusCond,&censusLock);
+		if (!censusPending)
+			break;
+		pthread_mutex_unlock(&censusLock);
+		if (!writeCensus())
+			fprintf(stderr,"[CENSUS] *** Writing census at clock %llu failed ***\n",(unsigned long long)census.clock);
+		pthread_mutex_lock(&censusLock);
+		censusPending = 0;
+	}
+	pthread_mutex_unlock(&censusLock);
+	return (void *)0;
+}
+#endif /* USE_PTHREADS_COUNT */
+
+/**
+ * Takes a genome census if one is due
+ *
+ * This is called by thread 0 after each report.
+ *
+ * @param clock Current clock
+ */
+static void takeCensus(const uint64_t clock)
+{
+	static uintptr_t reports = 0;
+	int pending;
+
+	if ((!censusPrefix)||(++reports < censusFrequency))
+		return;
+	reports = 0;
+
+#ifdef USE_PTHREADS_COUNT
+	pthread_mutex_lock(&censusLock);
+	pending = censusPending;
+	pthread_mutex_unlock(&censusLock);
+#else
+	pending = censusPending;
+#endif
+	if (pending) {
+		fprintf(stderr,"[CENSUS] Still writing the last census, skipping this one\n");
+		return;
+	}
+
+#ifdef USE_GPU_ENGINE
+	gpuCopyPondBack();
+#endif
+	collectCensus(clock);
+
+#ifdef USE_PTHREADS_COUNT
+	pthread_mutex_lock(&censusLock);
+	censusPending = 1;
+	if (!censusThreadRunning)
+		censusThreadRunning = (pthread_create(&censusThread,0,censusWriter,(void *)0) == 0);
+	pthread_cond_signal(&censusCond);
+	pthread_mutex_unlock(&censusLock);
+	if (censusThreadRunning)
+		return;
+	censusPending = 0;
+#endif
+	if (!writeCensus())
+		fprintf(stderr,"[CENSUS] *** Writing census at clock %llu failed ***\n",(unsigned long long)clock);
+}
+
+/* Waits for the last census to be written */
+static void finishCensus()
+{
+#ifdef USE_PTHREADS_COUNT
+	if (censusThreadRunning) {
+		pthread_mutex_lock(&censusLock);
+		censusExit = 1;
+		pthread_cond_signal(&censusCond);
+		pthread_mutex_unlock(&censusLock);
+		pthread_join(censusThread,(void **)0);
+		censusThreadRunning = 0;
+	}
+#endif
+}
+
+#ifdef USE_POW2_POND
+/* What to add to a cell index to move one cell in each direction, for
+ * the X part and the Y part of the index. Set up by initNeighborOffsets(). */
+static uintptr_t neighborOffsetX[4];
+static const uintptr_t neighborOffsetY[4] = { 0,0,~((uintptr_t)0),1 };
+
+static void initNeighborOffsets()
+{
+	neighborOffsetX[N_LEFT] = (uintptr_t)0 - pondSizeY;
+	neighborOffsetX[N_RIGHT] = pondSizeY;
+	neighborOffsetX[N_UP] = 0;
+	neighborOffsetX[N_DOWN] = 0;
+}
+
+static inline uintptr_t getNeighbor(const uintptr_t x,const uintptr_t y,const uintptr_t dir)
+{
+	/* Space is toroidal. X is in the high bits of the index and Y in the
+	 * low bits, so each part is moved separately and wraps when masked. */
+	const uintptr_t c = CELL_INDEX(x,y);
+	return (((c + neighborOffsetX[dir]) & (POND_SIZE - 1) & ~(pondSizeY - 1)) | ((c + neighborOffsetY[dir]) & (pondSizeY - 1)));
+}
+#else
+static inline uintptr_t getNeighbor(const uintptr_t x,const uintptr_t y,const uintptr_t dir)
+{
+	/* Space is toroidal; it wraps at edges */
+	switch(dir) {
+		case N_LEFT:
+			return (x) ? CELL_INDEX(x-1,y) : CELL_INDEX(pondSizeX-1,y);
+		case N_RIGHT:
+			return (x < (pondSizeX-1)) ? CELL_INDEX(x+1,y) : CELL_INDEX(0,y);
+		case N_UP:
+			return (y) ? CELL_INDEX(x,y-1) : CELL_INDEX(x,pondSizeY-1);
+		case N_DOWN:
+			return (y < (pondSizeY-1)) ? CELL_INDEX(x,y+1) : CELL_INDEX(x,0);
+	}
+	return CELL_INDEX(x,y); /* This should never be reached */
+}
+#endif /* USE_POW2_POND */
+
+static inline int accessAllowed(struct PRNG *const prng,const uintptr_t c2,const uintptr_t c1guess,int sense)
+{
+	/* Access permission is more probable if they are more similar in sense 0,
+	 * and more probable if they are different in sense 1. Sense 0 is used for
+	 * "negative" interactions and sense 1 for "positive" ones. */
+	return sense ? (((getRandom(prng) & 0xf) >= BITS_IN_FOURBIT_WORD[CELL_LOGO(c2) ^ (c1guess & 0xf)])||(!CELL_PARENT_ID(c2))) : (((getRandom(prng) & 0xf) <= BITS_IN_FOURBIT_WORD[CELL_LOGO(c2) ^ (c1guess & 0xf)])||(!CELL_PARENT_ID(c2)));
+}
+
+/* Repeats a 64-bit pattern across a machine word */
+#define SYSWORD_PATTERN(p) ((uintptr_t)(p##ULL))
+
+/**
+ * Sums the instructions of a genome for the KINSHIP color scheme
+ *
+ * Instructions are summed up to the first machine word that's all STOPs,
+ * leaving out STOPs and the operand after each XCHG. That's done a whole
+ * word at a time with bit tricks: each nibble gets a flag at its low bit,
+ * and which nibbles follow a counted XCHG comes from the parity of runs
+ * of XCHGs, found by adding the starts of odd-aligned runs to the runs,
+ * as for escaped characters in simdjson.
+ *
+ * @param genome Genome to sum
+ * @param high Words of genome in use
+ * @return Sum
+ */
+static uintptr_t kinshipSum(const uintptr_t *const genome,const uintptr_t high)
+{
+#ifdef KINSHIP_SCALAR
+	uintptr_t i,j,word,opcode;
+	uintptr_t skipnext = 0;
+	uintptr_t sum = 0;
+
+	for(i=0;i<high&&(genome[i] != ~((uintptr_t)0));++i) {
+		word = genome[i];
+		for(j=0;j<SYSWORD_NIBBLES;++j,word >>= 4) {
+			opcode = word & 0xf;
+			if (skipnext)
+				skipnext = 0;
+			else {
+				if (opcode != 0xf)
+					sum += opcode;
+				if (opcode == 0xc) /* 0xc == XCHG */
+					skipnext = 1; /* Skip "operand" after XCHG */
+			}
+		}
+	}
+	return sum;
+#else
+	const uintptr_t lowBits = SYSWORD_PATTERN(0x1111111111111111);
+	const uintptr_t evenLanes = SYSWORD_PATTERN(0x0101010101010101);
+	const uintptr_t byteLanes = SYSWORD_PATTERN(0x0f0f0f0f0f0f0f0f);
+	uintptr_t i,word,stops,xchgs,xchgRuns,follows,oddStarts,runs,skipped,counted;
+	uintptr_t skipFirst = 0; /* Operand of an XCHG at the end of the last word */
+	uintptr_t sum = 0;
+
+	for(i=0;i<high&&(genome[i] != ~((uintptr_t)0));++i) {
+		word = genome[i];
+
+		/* Flag nibbles that are 0xf and 0xc */
+		stops = word & (word >> 1) & (word >> 2) & (word >> 3) & lowBits;
+		xchgs = (word >> 3) & (word >> 2) & ~(word >> 1) & ~word & lowBits;
+
+		/* An XCHG that is itself an operand doesn't count */
+		xchgs &= ~skipFirst;
+		follows = (xchgs << 4) | skipFirst;
+		oddStarts = xchgs & ~evenLanes & ~follows;
+		xchgRuns = xchgs * 0xf;
+		runs = xchgRuns + oddStarts;
+		skipped = (evenLanes ^ (runs << 4)) & follows & lowBits;
+		skipFirst = (runs < xchgRuns) ? 1 : 0;
+
+		/* Sum the nibbles that are left, a byte at a time */
+		counted = word & ((~(stops | skipped) & lowBits) * 0xf);
+		counted = (counted & byteLanes) + ((counted >> 4) & byteLanes);
+		sum += (counted * SYSWORD_PATTERN(0x0101010101010101)) >> (SYSWORD_BITS - 8);
+	}
+	return sum;
+#endif /* KINSHIP_SCALAR */
+}
+
+#ifdef KINSHIP_CHECK_GENOMES
+/**
+ * Prints kinshipSum() of random and XCHG and STOP heavy genomes
+ *
+ * Genomes end at a random word, after which they're all STOPs, and are
+ * summed with a random number of words in use. Every other genome of the
+ * second half has runs of XCHGs across word boundaries.
+ */
+static void kinshipCheck()
+{
+	static uintptr_t genome[POND_DEPTH_SYSWORDS];
+	struct PRNG prng;
+	uintptr_t n,i,j,end,r,nibble,word;
+	double seconds = 0.0,start;
+
+	seedRandom(&prng,BENCHMARK_SEED,0);
+	for(n=0;n<(KINSHIP_CHECK_GENOMES * 2);++n) {
+		end = getRandom(&prng) % (POND_DEPTH_SYSWORDS + 1);
+		for(i=0;i<POND_DEPTH_SYSWORDS;++i) {
+			if (i >= end)
+				genome[i] = ~((uintptr_t)0);
+			else if (n < KINSHIP_CHECK_GENOMES)
+				genome[i] = getRandom(&prng);
+			else {
+				word = 0;
+				r = getRandom(&prng);
+				for(j=0;j<SYSWORD_NIBBLES;++j) {
+					if ((n & 1)&&((r & 0xff) < 0xe0))
+						nibble = 0xc;
+					else {
+						switch(r & 3) {
+							case 0:
+							case 1: nibble = 0xc; break;
+							case 2: nibble = 0xf; break;
+							default: nibble = (r >> 2) & 0xf; break;
+						}
+					}
+					word |= nibble << (j * 4);
+					r = getRandom(&prng);
+				}
+				genome[i] = word;
+			}
+		}
+		r = getRandom(&prng) % (POND_DEPTH_SYSWORDS + 1);
+		start = getSeconds();
+		word = kinshipSum(genome,r);
+		seconds += getSeconds() - start;
+		printf("%llu\n",(unsigned long long)word);
+	}
+	fprintf(stderr,"[KINSHIP] %.1f ns per genome\n",(seconds * 1000000000.0) / (double)(KINSHIP_CHECK_GENOMES * 2));
+}
+#endif /* KINSHIP_CHECK_GENOMES */
+
+static inline uint8_t computeColor(const uintptr_t c)
+{
+	if (CELL_ENERGY(c)) {
+		switch(colorScheme) {
+			case KINSHIP:
+				/*
+				 * Kinship color scheme by Christoph Groth
+				 *
+				 * For cells of generation > 1, saturation and value are set to maximum.
+				 * Hue is a hash-value with the property that related genomes will have
+				 * similar hue (but of course, as this is a hash function, totally
+				 * different genomes can also have a similar or even the same hue).
 				 * Therefore the difference in hue should to some extent reflect the grade
 				 * of "kinship" of two cells.
 				 */
-				if (c->generation > 1) {
-					sum = 0;
-					skipnext = 0;
-					for(i=0;i<POND_DEPTH_SYSWORDS&&(c->genome[i] != ~((uintptr_t)0));++i) {
-						word = c->genome[i];
-						for(j=0;j<SYSWORD_BITS/4;++j,word >>= 4) {
-							/* We ignore 0xf's here, because otherwise very similar genomes
-							 * might get quite different hash values in the case when one of
-							 * the genomes is slightly longer and uses one more maschine
-							 * word. */
-							opcode = word & 0xf;
-							if (skipnext)
-								skipnext = 0;
-							else {
-								if (opcode != 0xf)
-									sum += opcode;
-								if (opcode == 0xc) /* 0xc == XCHG */
-									skipnext = 1; /* Skip "operand" after XCHG */
-							}
-						}
-					}
-					/* For the hash-value use a wrapped around sum of the sum of all
-					 * commands and the length of the genome. */
-					return (uint8_t)((sum % 192) + 64);
+				if (CELL_GENERATION(c) > 1) {
+					/* 0xf's are ignored, because otherwise very similar genomes
+					 * might get quite different hash values in the case when one of
+					 * the genomes is slightly longer and uses one more maschine
+					 * word. So is the "operand" after an XCHG. For the hash-value
+					 * use a wrapped around sum of all commands. */
+					return (uint8_t)((kinshipSum(CELL_GENOME(c),CELL_GENOME_HIGH(c)) % 192) + 64);
 				}
 				return 0;
 			case LINEAGE:
 				/*
 				 * Cells with generation > 1 are color-coded by lineage.
 				 */
-				return (c->generation > 1) ? (((uint8_t)c->lineage) | (uint8_t)1) : 0;
+				return (CELL_GENERATION(c) > 1) ? (((uint8_t)CELL_LINEAGE(c)) | (uint8_t)1) : 0;
 			case MAX_COLOR_SCHEME:
 				/* ... never used... to make compiler shut up. */
 				break;
@@ -558,378 +2390,3673 @@ static inline uint8_t getColor(struct Cell *c)
 	return 0; /* Cells with no energy are black */
 }
 
-volatile int exitNow = 0;
+/* Gets the color of a cell from a snapshot without locking it */
+static inline uint8_t getColor(const uintptr_t c)
+{
+	uint32_t seq;
+	uint8_t color;
+	do {
+		seq = cellReadBegin(c);
+		color = computeColor(c);
+	} while (cellReadRetry(c,seq));
+	return color;
+}
+
+/* Position of the instruction after instruction q, wrapping around to
+ * the start of execution like the VM does */
+#define NEXT_NIBBLE(q) (((q) + 1 < POND_DEPTH) ? ((q) + 1) : ((EXEC_START_WORD * SYSWORD_NIBBLES) + (EXEC_START_BIT / 4)))
+
+/**
+ * Matching REP positions of the LOOPs in the genome being executed
+ *
+ * Entries are filled in lazily the first time a LOOP turns out false and
+ * are valid while their tag equals epoch. Bumping epoch throws them all
+ * away, which is done at the start of each cell execution and whenever
+ * the cell writes its own genome (WRITEG and XCHG). KILL and offspring
+ * copies only ever write other cells, which get a fresh index when they
+ * execute. Each thread owns one of these.
+ */
+struct CACHE_ALIGNED LoopIndex
+{
+	uint32_t epoch;
+	uint32_t tag[POND_DEPTH];
+
+	/* Instructions from the LOOP to its matching REP inclusive, or zero
+	 * if it's not matched within one trip around the genome */
+	uint32_t distance[POND_DEPTH];
+};
+
+static struct LoopIndex *loopIndex;
+
+/* Invalidates all entries of an index */
+static inline void invalidateLoopIndex(struct LoopIndex *const li)
+{
+	if (!++li->epoch) {
+		memset(li->tag,0,sizeof(li->tag));
+		li->epoch = 1;
+	}
+}
+
+#ifndef USE_BATCH_ENGINE
+/**
+ * Skips a false LOOP, jumping straight to its matching REP if possible
+ *
+ * Skipped instructions still cost a unit of energy and a mutation roll
+ * each, but the matching REP comes from the index and the rolls are
+ * checked in bulk. If energy runs out or a mutation would happen inside
+ * the loop, this stops just before that point so the caller can go on
+ * walking the loop one instruction at a time as usual.
+ *
+ * @param li Loop index of the executing thread
+ * @param prng Generator to use
+ * @param genome Genome being executed
+ * @param wordPtr Word of the false LOOP, updated to the last instruction skipped
+ * @param shiftPtr Shift of the false LOOP, updated likewise
+ * @param energy Energy of the executing cell, reduced by instructions skipped
+ * @return False LOOP depth left, zero if the matching REP was reached
+ */
+static uintptr_t skipFalseLoop(struct LoopIndex *const li,struct PRNG *const prng,const uintptr_t *const genome,uintptr_t *const wordPtr,uintptr_t *const shiftPtr,uintptr_t *const energy)
+{
+	const uintptr_t start = (*wordPtr * SYSWORD_NIBBLES) + (*shiftPtr / 4);
+	uintptr_t q,d,n,inst,depth;
+
+	if (li->tag[start] != li->epoch) {
+		/* Find the matching REP as walking the loop would */
+		li->tag[start] = li->epoch;
+		li->distance[start] = 0;
+		depth = 1;
+		q = start;
+		for(d=1;d<POND_DEPTH;++d) {
+			q = NEXT_NIBBLE(q);
+			inst = (genome[q / SYSWORD_NIBBLES] >> ((q % SYSWORD_NIBBLES) * 4)) & 0xf;
+			if (inst == 0x9)
+				++depth;
+			else if ((inst == 0xa)&&(!--depth)) {
+				li->distance[start] = (uint32_t)d;
+				break;
+			}
+		}
+	}
+
+	d = li->distance[start];
+	if (!d)
+		return 1;
+	n = (d < *energy) ? d : *energy;
+	n = skipMutationChecks(prng,n);
+	*energy -= n;
+
+	if (n == d) {
+		q = (start + d < POND_DEPTH) ? (start + d) : (start + d - POND_DEPTH + (EXEC_START_WORD * SYSWORD_NIBBLES) + (EXEC_START_BIT / 4));
+		depth = 0;
+	} else {
+		/* Stopped short, so find out how deep in the loop we are */
+		depth = 1;
+		q = start;
+		while (n--) {
+			q = NEXT_NIBBLE(q);
+			inst = (genome[q / SYSWORD_NIBBLES] >> ((q % SYSWORD_NIBBLES) * 4)) & 0xf;
+			if (inst == 0x9)
+				++depth;
+			else if (inst == 0xa)
+				--depth;
+		}
+	}
+
+	*wordPtr = q / SYSWORD_NIBBLES;
+	*shiftPtr = (q % SYSWORD_NIBBLES) * 4;
+	return depth;
+}
+#endif /* !USE_BATCH_ENGINE */
+
+volatile int exitNow = 0;
+
+/**
+ * Where a thread executing cells gets random numbers and new cell IDs,
+ * and where it counts statistics.
+ *
+ * The random scheduler uses the thread's own generator and the global
+ * cell ID counter. The tiled scheduler points these at the tile being
+ * run instead, so results don't depend on which thread runs which tile.
+ */
+struct ExecContext
+{
+	struct PRNG *prng;
+	struct StatCounters *stats;
+	struct LoopIndex *loops;
+#ifdef USE_BATCH_ENGINE
+	struct Batch *batch;
+#endif
+
+	/* New cell IDs are taken from here, advancing it by cellIdStep */
+	volatile uint64_t *cellIdCounter;
+	uint64_t cellIdStep;
+};
+
+/* Takes n cell IDs, returning the first; the others follow it cellIdStep
+ * apart */
+static inline uint64_t newCellIds(const struct ExecContext *const ctx,const uint64_t n)
+{
+#ifdef USE_CELL_LOCKS
+	return __atomic_fetch_add(ctx->cellIdCounter,ctx->cellIdStep * n,__ATOMIC_RELAXED);
+#else
+	const uint64_t id = *(ctx->cellIdCounter);
+	*(ctx->cellIdCounter) = id + (ctx->cellIdStep * n);
+	return id;
+#endif
+}
+
+static inline uint64_t newCellId(const struct ExecContext *const ctx)
+{
+	return newCellIds(ctx,1);
+}
+
+#ifdef USE_SDL
+/*
+ * Dirty cells
+ *
+ * The screen surface doubles as a cache of each cell's color. Instead of
+ * recoloring cells as they run, threads mark the cells whose color may
+ * have changed in dirtyCells (a bit per cell) and then dirtyRegions (a
+ * bit per dirtyCells word), and refreshDisplay() recolors only those.
+ * Cells are marked while they are locked, so the snapshot taken when
+ * they are recolored can't miss the change.
+ */
+static uint64_t *dirtyCells;
+static uint64_t *dirtyRegions;
+#define DIRTY_CELL_WORDS ((POND_SIZE + 63) / 64)
+#define DIRTY_REGION_WORDS ((DIRTY_CELL_WORDS + 63) / 64)
+#endif /* USE_SDL */
+
+#ifdef USE_MPI
+/* A byte per cell of the left (0) and right (1) ghost columns, set when
+ * a cell of ours has written to that ghost this phase. These are the
+ * start of the buffers sent to the neighboring ranks, see exchangeHalos(). */
+static uint8_t *haloDirty[2];
+#endif
+
+/* Marks a cell to be recolored on the next refresh, if there's SDL, and
+ * whether it's a ghost that must be sent back to its owner with MPI */
+static inline void markDirty(const uintptr_t c)
+{
+#ifdef USE_MPI
+	if (c < pondSizeY)
+		haloDirty[0][c] = 1;
+	else if (c >= (POND_SIZE - pondSizeY))
+		haloDirty[1][c - (POND_SIZE - pondSizeY)] = 1;
+#endif
+#ifdef USE_SDL
+	const uint64_t bit = ((uint64_t)1) << (c & 63);
+#ifdef USE_PTHREADS_COUNT
+	if (!(__atomic_load_n(&dirtyCells[c >> 6],__ATOMIC_RELAXED) & bit)) {
+		__atomic_fetch_or(&dirtyCells[c >> 6],bit,__ATOMIC_RELAXED);
+		__atomic_fetch_or(&dirtyRegions[c >> 12],((uint64_t)1) << ((c >> 6) & 63),__ATOMIC_RELEASE);
+	}
+#else
+	dirtyCells[c >> 6] |= bit;
+	dirtyRegions[c >> 12] |= ((uint64_t)1) << ((c >> 6) & 63);
+#endif
+#else
+	(void)c;
+#endif
+}
+
+#ifdef USE_SDL
+/* Takes a word of dirty bits, leaving it clear */
+static inline uint64_t takeDirtyBits(uint64_t *const w)
+{
+#ifdef USE_PTHREADS_COUNT
+	return (__atomic_load_n(w,__ATOMIC_RELAXED)) ? __atomic_exchange_n(w,0,__ATOMIC_ACQUIRE) : 0;
+#else
+	const uint64_t bits = *w;
+	*w = 0;
+	return bits;
+#endif
+}
+
+/* Recolors every dirty cell on the SDL screen */
+static void drawDirtyCells(void)
+{
+	uintptr_t r,w,c;
+	uint64_t regionBits,cellBits;
+	uint8_t *const pixels = (uint8_t *)screen->pixels;
+
+	for(r=0;r<DIRTY_REGION_WORDS;++r) {
+		regionBits = takeDirtyBits(&dirtyRegions[r]);
+		while (regionBits) {
+			w = (r << 6) + (uintptr_t)__builtin_ctzll(regionBits);
+			regionBits &= regionBits - 1;
+			cellBits = takeDirtyBits(&dirtyCells[w]);
+			while (cellBits) {
+				c = (w << 6) + (uintptr_t)__builtin_ctzll(cellBits);
+				cellBits &= cellBits - 1;
+				/* Cells are in column order, see CELL_INDEX() */
+				pixels[POND_DIV_Y(c) + (POND_MOD_Y(c) * (uintptr_t)screen->pitch)] = getColor(c);
+			}
+		}
+	}
+}
+
+#ifdef CHECK_DISPLAY
+/* Exits if any pixel differs from a redraw of its cell */
+static void checkDisplay(void)
+{
+	uintptr_t x,y,bad = 0;
+	const uint8_t *const pixels = (const uint8_t *)screen->pixels;
+
+	for(y=0;y<pondSizeY;++y) {
+		for(x=0;x<pondSizeX;++x) {
+			if (pixels[x + (y * (uintptr_t)screen->pitch)] != getColor(CELL_INDEX(x,y)))
+				++bad;
+		}
+	}
+	if (bad) {
+		fprintf(stderr,"[DISPLAY] *** %llu of %llu pixels differ from their cells ***\n",(unsigned long long)bad,(unsigned long long)POND_SIZE);
+		exit(1);
+	}
+}
+#endif
+
+/* Marks the whole pond to be recolored */
+static void markAllDirty(void)
+{
+	uintptr_t c;
+	for(c=0;c<POND_SIZE;++c)
+		markDirty(c);
+}
+
+/**
+ * Handles SDL events and refreshes the window
+ *
+ * This must only be called by thread 0.
+ */
+static void refreshDisplay()
+{
+	SDL_Event sdlEvent;
+
+	while (SDL_PollEvent(&sdlEvent)) {
+		if (sdlEvent.type == SDL_QUIT) {
+			fprintf(stderr,"[QUIT] Quit signal received!\n");
+			exitNow = 1;
+		} else if (sdlEvent.type == SDL_MOUSEBUTTONDOWN) {
+			switch (sdlEvent.button.button) {
+				case SDL_BUTTON_LEFT:
+					fprintf(stderr,"[INTERFACE] Genome of cell at (%d, %d):\n",sdlEvent.button.x, sdlEvent.button.y);
+					dumpCell(stderr, CELL_INDEX(sdlEvent.button.x,sdlEvent.button.y));
+					break;
+				case SDL_BUTTON_RIGHT:
+					colorScheme = (colorScheme + 1) % MAX_COLOR_SCHEME;
+					fprintf(stderr,"[INTERFACE] Switching to color scheme \"%s\".\n",colorSchemeName[colorScheme]);
+					markAllDirty();
+					break;
+			}
+		}
+	}
+	drawDirtyCells();
+#ifdef CHECK_DISPLAY
+	checkDisplay();
+#endif
+	SDL_BlitSurface(screen, NULL, winsurf, NULL);
+	SDL_UpdateWindowSurface(window);
+}
+#endif /* USE_SDL */
+
+/* Words of genome in a cache line */
+#define GENOME_LINE_WORDS (CACHE_LINE_SIZE / sizeof(uintptr_t))
+
+/**
+ * Gets the output buffer ready for use up to a given word
+ *
+ * The output buffer starts out as all ~0, but most cells never write
+ * more than a little of it, so it's reset lazily a cache line at a time:
+ * *high is the number of words reset so far.
+ *
+ * @param outputBuf Output buffer
+ * @param high High-water mark of words reset
+ * @param w Word about to be used
+ */
+static inline void touchOutput(uintptr_t *const outputBuf,uintptr_t *const high,const uintptr_t w)
+{
+	uintptr_t i,end = ((w / GENOME_LINE_WORDS) + 1) * GENOME_LINE_WORDS;
+	if (end > POND_DEPTH_SYSWORDS)
+		end = POND_DEPTH_SYSWORDS;
+	for(i=*high;i<end;++i)
+		outputBuf[i] = ~((uintptr_t)0);
+	*high = end;
+}
+
+/**
+ * Writes an offspring genome into a cell
+ *
+ * Words from used on are filled with ~0 instead of being copied, but
+ * only up to old since the rest of dst already is.
+ *
+ * @param dst Genome to write (cache line aligned)
+ * @param src Output buffer (cache line aligned)
+ * @param used Words of src in use
+ * @param old Words of dst that may not be ~0
+ */
+static inline void copyGenome(uintptr_t *const dst,const uintptr_t *const src,const uintptr_t used,const uintptr_t old)
+{
+	uintptr_t i = 0;
+#ifdef USE_STREAMING_STORES
+	const uintptr_t chunk = sizeof(__m128i) / sizeof(uintptr_t);
+	const __m128i ones = _mm_set1_epi32(-1);
+	for(;(i + chunk) <= used;i += chunk)
+		_mm_stream_si128((__m128i *)(dst + i),_mm_load_si128((const __m128i *)(src + i)));
+	if (i >= used) {
+		for(;(i + chunk) <= old;i += chunk)
+			_mm_stream_si128((__m128i *)(dst + i),ones);
+	}
+	for(;(i<used)||(i<old);++i)
+		dst[i] = (i < used) ? src[i] : ~((uintptr_t)0);
+	/* Streaming stores must be seen before the cell is unlocked */
+	_mm_sfence();
+#else
+	for(;i<used;++i)
+		dst[i] = src[i];
+	for(;i<old;++i)
+		dst[i] = ~((uintptr_t)0);
+#endif
+}
+
+#ifdef USE_GENOME_STORE
+
+/* Hashes a genome whose words from used on are all ~0, and where
+ * used is as small as it can be */
+static inline uint64_t hashGenome(const uintptr_t *const words,const uintptr_t used)
+{
+	uint64_t h = (uint64_t)used * 0x9e3779b97f4a7c15ULL;
+	uintptr_t i;
+	for(i=0;i<used;++i) {
+		h = (h ^ (uint64_t)words[i]) * 0xbf58476d1ce4e5b9ULL;
+		h ^= h >> 31;
+	}
+	return h;
+}
+
+/* Gets an unused block for a cell of a stripe */
+static struct GenomeBlock *allocGenomeBlock(struct GenomeStripe *const st)
+{
+	struct GenomeBlock *b;
+	uintptr_t i;
+	genomeStripeLock(st);
+	if (!st->freeList) {
+		b = (struct GenomeBlock *)allocGenomeMemory(sizeof(struct GenomeBlock) * GENOME_STORE_CHUNK);
+		for(i=0;i<GENOME_STORE_CHUNK;++i) {
+			b[i].next = st->freeList;
+			st->freeList = &b[i];
+		}
+		st->blocks += GENOME_STORE_CHUNK;
+	}
+	b = st->freeList;
+	st->freeList = b->next;
+	++st->blocksUsed;
+	genomeStripeUnlock(st);
+	return b;
+}
+
+/* Puts an unused block on the free list of a stripe */
+static void freeGenomeBlock(struct GenomeStripe *const st,struct GenomeBlock *const b)
+{
+	genomeStripeLock(st);
+	b->next = st->freeList;
+	st->freeList = b;
+	--st->blocksUsed;
+	genomeStripeUnlock(st);
+}
+
+/* Takes an interned block out of the table; its stripe must be locked */
+static void uninternGenomeBlock(struct GenomeBlock *const b)
+{
+	struct GenomeBlock **p = &genomeTable[b->hash & genomeTableMask];
+	while (*p != b)
+		p = &((*p)->next);
+	*p = b->next;
+	b->interned = 0;
+}
+
+/* Drops a cell's reference to a block, freeing it to the cell's stripe
+ * if that was the last one */
+static void dropGenomeBlock(struct GenomeStripe *const st,struct GenomeBlock *const b)
+{
+	struct GenomeStripe *hs;
+	uintptr_t refs;
+	if (b->interned) {
+		hs = genomeHashStripe(b->hash);
+		genomeStripeLock(hs);
+		if (!(refs = --b->refs))
+			uninternGenomeBlock(b);
+		genomeStripeUnlock(hs);
+		if (refs)
+			return;
+	}
+	freeGenomeBlock(st,b);
+}
+
+/**
+ * Gets a genome a cell can write to, copying it if it's shared
+ *
+ * @param ref The cell's block pointer, which may be changed
+ * @param st The cell's stripe
+ * @return Words of genome
+ */
+static uintptr_t *genomeForWrite(struct GenomeBlock **const ref,struct GenomeStripe *const st)
+{
+	struct GenomeBlock *const b = *ref;
+	struct GenomeStripe *hs;
+	struct GenomeBlock *nb;
+	if (!b->interned)
+		return b->words;
+	hs = genomeHashStripe(b->hash);
+	genomeStripeLock(hs);
+	if (b->refs == 1) {
+		uninternGenomeBlock(b);
+		genomeStripeUnlock(hs);
+		return b->words;
+	}
+	genomeStripeUnlock(hs);
+	nb = allocGenomeBlock(st);
+	memcpy(nb->words,b->words,sizeof(nb->words));
+	nb->refs = 1;
+	nb->interned = 0;
+	*ref = nb;
+	dropGenomeBlock(st,b);
+	return nb->words;
+}
+
+/**
+ * Points a cell to the interned copy of a genome, adding it if needed
+ *
+ * @param ref The cell's block pointer
+ * @param st The cell's stripe
+ * @param src Genome, of which words from used on are taken to be ~0
+ * @param used Words of src in use
+ */
+static void internGenome(struct GenomeBlock **const ref,struct GenomeStripe *const st,const uintptr_t *const src,uintptr_t used)
+{
+	struct GenomeBlock *b,*nb = (struct GenomeBlock *)0;
+	struct GenomeStripe *hs;
+	uint64_t h;
+	uintptr_t i;
+
+	while ((used)&&(src[used - 1] == ~((uintptr_t)0)))
+		--used;
+	h = hashGenome(src,used);
+	hs = genomeHashStripe(h);
+
+	/* A new block is filled in before the bucket is locked, in case no
+	 * copy is found */
+	for(;;) {
+		genomeStripeLock(hs);
+		for(b=genomeTable[h & genomeTableMask];b;b=b->next) {
+			if ((b->hash == h)&&(!memcmp(b->words,src,used * sizeof(uintptr_t)))) {
+				for(i=used;(i<POND_DEPTH_SYSWORDS)&&(b->words[i] == ~((uintptr_t)0));++i);
+				if (i == POND_DEPTH_SYSWORDS)
+					break;
+			}
+		}
+		if (b) {
+			++b->refs;
+			break;
+		}
+		if (nb) {
+			b = nb;
+			nb = (struct GenomeBlock *)0;
+			b->next = genomeTable[h & genomeTableMask];
+			genomeTable[h & genomeTableMask] = b;
+			break;
+		}
+		genomeStripeUnlock(hs);
+		nb = allocGenomeBlock(st);
+		copyGenome(nb->words,src,used,POND_DEPTH_SYSWORDS);
+		nb->hash = h;
+		nb->refs = 1;
+		nb->interned = 1;
+	}
+	genomeStripeUnlock(hs);
+
+	/* Someone else interned it while the new block was filled in */
+	if (nb)
+		freeGenomeBlock(st,nb);
+	dropGenomeBlock(st,*ref);
+	*ref = b;
+}
+
+/* The all ~0 genome every cell starts out with */
+static struct GenomeBlock *emptyGenome;
+
+/* Sets up the store with emptyGenome interned */
+static void initGenomeStore()
+{
+	struct GenomeBlock *b;
+	for(genomeTableMask=1;genomeTableMask<POND_SIZE;genomeTableMask<<=1);
+	genomeTable = (struct GenomeBlock **)allocPondMemory(sizeof(struct GenomeBlock *) * genomeTableMask);
+	--genomeTableMask;
+	b = allocGenomeBlock(genomeCellStripe(0));
+	copyGenome(b->words,b->words,0,POND_DEPTH_SYSWORDS);
+	b->hash = hashGenome(b->words,0);
+	b->refs = POND_SIZE;
+	b->interned = 1;
+	b->next = (struct GenomeBlock *)0;
+	genomeTable[b->hash & genomeTableMask] = b;
+	emptyGenome = b;
+}
+
+#endif /* USE_GENOME_STORE */
+
+/**
+ * Introduces a random cell with a given energy level
+ *
+ * This is called seeding, and introduces both energy and entropy into
+ * the substrate.
+ *
+ * @param ctx Execution context
+ * @param x X coordinate of cell
+ * @param y Y coordinate of cell
+ */
+static void seedCell(const struct ExecContext *const ctx,const uintptr_t x,const uintptr_t y)
+{
+	const uintptr_t cell = CELL_INDEX(x,y);
+	uintptr_t energy;
+
+	cellLock(cell);
+
+	energy = CELL_ENERGY(cell) + inflowRateBase;
+	if (inflowRateVariation)
+		energy += getRandom(ctx->prng) % inflowRateVariation;
+	accountCell(ctx->stats,CELL_ENERGY(cell),CELL_GENERATION(cell),energy,0);
+
+	CELL_ID(cell) = newCellId(ctx);
+	CELL_PARENT_ID(cell) = 0;
+	CELL_LINEAGE(cell) = CELL_ID(cell);
+	CELL_GENERATION(cell) = 0;
+	CELL_ENERGY(cell) = energy;
+	fillRandom(ctx->prng,CELL_GENOME_W(cell),POND_DEPTH_SYSWORDS);
+	CELL_GENOME_HIGH(cell) = POND_DEPTH_SYSWORDS;
+	CELL_SYNC_LOGO(cell);
+	markDirty(cell);
+
+	cellUnlock(cell);
+}
+
+/**
+ * Checks whether a picked cell has no energy to run with
+ *
+ * Most cells picked at random, especially early in a run, have none, and
+ * running one would do nothing but count it. The check is made without
+ * locking; another thread giving the cell energy at the same time is no
+ * different from running it just before that. A dead cell is counted as
+ * an execution, as running it would have been, unless another thread
+ * holds its lock: then it would have been skipped like any busy cell.
+ *
+ * @param stats Counters, where the cell is counted if it has no energy
+ * @param cell Cell index
+ * @return Nonzero if the cell has no energy
+ */
+static inline int deadCell(struct StatCounters *const stats,const uintptr_t cell)
+{
+#ifdef USE_PTHREADS_COUNT
+	if (__atomic_load_n(&CELL_ENERGY(cell),__ATOMIC_RELAXED))
+		return 0;
+#else
+	if (CELL_ENERGY(cell))
+		return 0;
+#endif
+	if (!cellLocked(cell))
+		++stats->cellExecutions;
+	return 1;
+}
+
+#ifndef USE_BATCH_ENGINE
+/**
+ * Executes a cell until it stops or runs out of energy
+ *
+ * If the cell leaves a candidate offspring in its output buffer, this
+ * is then copied into the neighbor it is facing if permitted.
+ *
+ * @param ctx Execution context
+ * @param x X coordinate of cell
+ * @param y Y coordinate of cell
+ */
+static void execCell(const struct ExecContext *const ctx,const uintptr_t x,const uintptr_t y)
+{
+	struct PRNG *const prng = ctx->prng;
+	struct StatCounters *const stats = ctx->stats;
+	const uintptr_t cell = CELL_INDEX(x,y);
+	uintptr_t *genome = CELL_GENOME(cell);
+	uintptr_t startEnergy,startGeneration;
+
+	/* Buffer used for execution output of candidate offspring, which is
+	 * ~0 wherever it is used as of outputHigh (see touchOutput()) */
+	CACHE_ALIGNED uintptr_t outputBuf[POND_DEPTH_SYSWORDS];
+	uintptr_t outputHigh;
+
+	/* Miscellaneous variables used in the loop */
+	uintptr_t currentWord,wordPtr,shiftPtr,inst,tmp;
+	uintptr_t nbr;
+	
+	/* Virtual machine memory pointer register (which
+	 * exists in two parts... read the code below...) */
+	uintptr_t ptr_wordPtr;
+	uintptr_t ptr_shiftPtr;
+	
+	/* The main "register" */
+	uintptr_t reg;
+	
+	/* Which way is the cell facing? */
+	uintptr_t facing;
+	
+	/* Virtual machine loop/rep stack */
+	uintptr_t loopStack_wordPtr[POND_DEPTH];
+	uintptr_t loopStack_shiftPtr[POND_DEPTH];
+	uintptr_t loopStackPtr;
+	
+	/* If this is nonzero, we're skipping to matching REP */
+	/* It is incremented to track the depth of a nested set
+	 * of LOOP/REP pairs in false state. */
+	uintptr_t falseLoopDepth;
+
+#ifndef USE_THREADED_DISPATCH
+	/* If this is nonzero, cell execution stops. This allows us
+	 * to avoid the ugly use of a goto to exit the loop. :) */
+	int stop;
+#endif
+
+#ifdef USE_PROFILING
+	/* When execution started, instructions it ran, and energy before a
+	 * false LOOP skip */
+	uint64_t profStart;
+	uintptr_t profInstructions = 0,profEnergy;
+#endif
+
+	if (deadCell(stats,cell))
+		return;
+
+	/* The cell stays locked while it executes. If another thread has
+	 * it (it's executing or being interacted with) we skip it. */
+	if (!cellTryLock(cell))
+		return;
+	PROFILE(profStart = getCycles();)
+
+	/* What the cell itself ends up changing is accounted for at the end */
+	startEnergy = CELL_ENERGY(cell);
+	startGeneration = CELL_GENERATION(cell);
+
+	/* Reset the state of the VM prior to execution */
+	outputHigh = 0;
+	ptr_wordPtr = 0;
+	ptr_shiftPtr = 0;
+	reg = 0;
+	loopStackPtr = 0;
+	wordPtr = EXEC_START_WORD;
+	shiftPtr = EXEC_START_BIT;
+	facing = 0;
+	falseLoopDepth = 0;
+#ifndef USE_THREADED_DISPATCH
+	stop = 0;
+#endif
+
+	/* We use a currentWord buffer to hold the word we're
+	 * currently working on.  This speeds things up a bit
+	 * since it eliminates a pointer dereference in the
+	 * inner loop. We have to be careful to refresh this
+	 * whenever it might have changed... take a look at
+	 * the code. :) */
+	currentWord = genome[0];
+
+	/* Keep track of how many cells have been executed */
+	++stats->cellExecutions;
+
+	/* LOOP matches found for the previous cell don't apply to this one */
+	invalidateLoopIndex(ctx->loops);
+
+#ifdef USE_THREADED_DISPATCH
+	/*
+	 * Threaded code version of the core execution loop below, using
+	 * labels as values (a GCC/Clang extension). Every instruction handler
+	 * fetches and dispatches the next instruction itself, so there is an
+	 * indirect jump per handler for the branch predictor to learn instead
+	 * of a single shared switch. False LOOPs are skipped by their own
+	 * small scanner loop instead of a falseLoopDepth check in front of
+	 * every instruction. Energy is kept in a register; nobody else can
+	 * touch it while the cell is executing.
+	 *
+	 * The semantics are exactly those of the switch version, down to the
+	 * order in which random numbers are consumed.
+	 */
+	{
+		static const void *const dispatchTable[16] = {
+			&&op_zero,&&op_fwd,&&op_back,&&op_inc,&&op_dec,&&op_readg,&&op_writeg,&&op_readb,
+			&&op_writeb,&&op_loop,&&op_rep,&&op_turn,&&op_xchg,&&op_kill,&&op_share,&&op_stop
+		};
+		uintptr_t energy = CELL_ENERGY(cell);
+
+/* Advance the shift and word pointers, wrapping to the start */
+#define VM_ADVANCE() \
+		if ((shiftPtr += 4) >= SYSWORD_BITS) { \
+			if (++wordPtr >= POND_DEPTH_SYSWORDS) { \
+				wordPtr = EXEC_START_WORD; \
+				shiftPtr = EXEC_START_BIT; \
+			} else shiftPtr = 0; \
+			currentWord = genome[wordPtr]; \
+		}
+
+/* Get the next instruction, maybe mutate, and pay for it */
+#define VM_FETCH() \
+		inst = (currentWord >> shiftPtr) & 0xf; \
+		if (checkMutation(prng)) { \
+			tmp = getRandom(prng); \
+			if (tmp & 0x80) \
+				inst = tmp & 0xf; \
+			else reg = tmp & 0xf; \
+		} \
+		--energy;
+
+/* Execute the instruction at the current position */
+#define VM_DISPATCH() \
+		{ \
+			if (!energy) \
+				goto vm_done; \
+			VM_FETCH(); \
+			++stats->instructionExecutions[inst]; \
+			PROFILE(++profInstructions;) \
+			goto *dispatchTable[inst]; \
+		}
+
+/* Execute the instruction after the current one */
+#define VM_NEXT() { VM_ADVANCE(); VM_DISPATCH(); }
+
+		VM_DISPATCH();
+
+op_zero: /* ZERO: Zero VM state registers */
+		reg = 0;
+		ptr_wordPtr = 0;
+		ptr_shiftPtr = 0;
+		facing = 0;
+		VM_NEXT();
+op_fwd: /* FWD: Increment the pointer (wrap at end) */
+		if ((ptr_shiftPtr += 4) >= SYSWORD_BITS) {
+			if (++ptr_wordPtr >= POND_DEPTH_SYSWORDS)
+				ptr_wordPtr = 0;
+			ptr_shiftPtr = 0;
+		}
+		VM_NEXT();
+op_back: /* BACK: Decrement the pointer (wrap at beginning) */
+		if (ptr_shiftPtr)
+			ptr_shiftPtr -= 4;
+		else {
+			if (ptr_wordPtr)
+				--ptr_wordPtr;
+			else ptr_wordPtr = POND_DEPTH_SYSWORDS - 1;
+			ptr_shiftPtr = SYSWORD_BITS - 4;
+		}
+		VM_NEXT();
+op_inc: /* INC: Increment the register */
+		reg = (reg + 1) & 0xf;
+		VM_NEXT();
+op_dec: /* DEC: Decrement the register */
+		reg = (reg - 1) & 0xf;
+		VM_NEXT();
+op_readg: /* READG: Read into the register from genome */
+		reg = (genome[ptr_wordPtr] >> ptr_shiftPtr) & 0xf;
+		VM_NEXT();
+op_writeg: /* WRITEG: Write out from the register to genome */
+		genome = CELL_GENOME_W(cell);
+		CELL_GENOME_TOUCH(cell,ptr_wordPtr);
+		genome[ptr_wordPtr] &= ~(((uintptr_t)0xf) << ptr_shiftPtr);
+		genome[ptr_wordPtr] |= reg << ptr_shiftPtr;
+		if (!ptr_wordPtr)
+			CELL_SYNC_LOGO(cell);
+		invalidateLoopIndex(ctx->loops);
+		currentWord = genome[wordPtr]; /* Must refresh in case this changed! */
+		VM_NEXT();
+op_readb: /* READB: Read into the register from buffer */
+		if (ptr_wordPtr >= outputHigh)
+			touchOutput(outputBuf,&outputHigh,ptr_wordPtr);
+		reg = (outputBuf[ptr_wordPtr] >> ptr_shiftPtr) & 0xf;
+		VM_NEXT();
+op_writeb: /* WRITEB: Write out from the register to buffer */
+		if (ptr_wordPtr >= outputHigh)
+			touchOutput(outputBuf,&outputHigh,ptr_wordPtr);
+		outputBuf[ptr_wordPtr] &= ~(((uintptr_t)0xf) << ptr_shiftPtr);
+		outputBuf[ptr_wordPtr] |= reg << ptr_shiftPtr;
+		VM_NEXT();
+op_loop: /* LOOP: Jump forward to matching REP if register is zero */
+		if (reg) {
+			if (loopStackPtr >= POND_DEPTH)
+				goto vm_done; /* Stack overflow ends execution */
+			loopStack_wordPtr[loopStackPtr] = wordPtr;
+			loopStack_shiftPtr[loopStackPtr] = shiftPtr;
+			++loopStackPtr;
+			VM_NEXT();
+		}
+		/* Jump to the matching REP, or walk the rest of the way to it if
+		 * that's not possible. Skipped instructions still cost energy and
+		 * can still be mutated, but aren't executed or counted. */
+		PROFILE(++stats->prof.falseLoops;)
+		PROFILE(profEnergy = energy;)
+		falseLoopDepth = skipFalseLoop(ctx->loops,prng,genome,&wordPtr,&shiftPtr,&energy);
+		PROFILE(stats->prof.falseLoopSkipped += profEnergy - energy;)
+		currentWord = genome[wordPtr];
+		while (falseLoopDepth) {
+			VM_ADVANCE();
+			if (!energy)
+				goto vm_done;
+			VM_FETCH();
+			PROFILE(++stats->prof.falseLoopSkipped;)
+			if (inst == 0x9) /* Increment false LOOP depth */
+				++falseLoopDepth;
+			else if (inst == 0xa) /* Decrement on REP */
+				--falseLoopDepth;
+		}
+		VM_NEXT();
+op_rep: /* REP: Jump back to matching LOOP if register is nonzero */
+		if (loopStackPtr) {
+			--loopStackPtr;
+			if (reg) {
+				wordPtr = loopStack_wordPtr[loopStackPtr];
+				shiftPtr = loopStack_shiftPtr[loopStackPtr];
+				currentWord = genome[wordPtr];
+				/* This ensures that the LOOP is rerun */
+				VM_DISPATCH();
+			}
+		}
+		VM_NEXT();
+op_turn: /* TURN: Turn in the direction specified by register */
+		facing = reg & 3;
+		VM_NEXT();
+op_xchg: /* XCHG: Skip next instruction and exchange value of register with it */
+		if ((shiftPtr += 4) >= SYSWORD_BITS) {
+			if (++wordPtr >= POND_DEPTH_SYSWORDS) {
+				wordPtr = EXEC_START_WORD;
+				shiftPtr = EXEC_START_BIT;
+			} else shiftPtr = 0;
+		}
+		tmp = reg;
+		genome = CELL_GENOME_W(cell);
+		CELL_GENOME_TOUCH(cell,wordPtr);
+		reg = (genome[wordPtr] >> shiftPtr) & 0xf;
+		genome[wordPtr] &= ~(((uintptr_t)0xf) << shiftPtr);
+		genome[wordPtr] |= tmp << shiftPtr;
+		if (!wordPtr)
+			CELL_SYNC_LOGO(cell);
+		invalidateLoopIndex(ctx->loops);
+		currentWord = genome[wordPtr];
+		VM_NEXT();
+op_kill: /* KILL: Blow away neighboring cell if allowed with penalty on failure */
+		nbr = getNeighbor(x,y,facing);
+		if (lockNeighbor(stats,PROFILE_KILL,cell,nbr)) {
+			if (accessAllowed(prng,nbr,reg,0)) {
+				if (CELL_GENERATION(nbr) > 2)
+					++stats->viableCellsKilled;
+
+				/* Filling first two words with 0xfffff... is enough */
+				CELL_MATERIALIZE(nbr);
+				CELL_GENOME_W(nbr)[0] = ~((uintptr_t)0);
+				CELL_GENOME_W(nbr)[1] = ~((uintptr_t)0);
+				CELL_SYNC_LOGO(nbr);
+				CELL_ID(nbr) = newCellId(ctx);
+				CELL_PARENT_ID(nbr) = 0;
+				CELL_LINEAGE(nbr) = CELL_ID(nbr);
+				accountCell(stats,CELL_ENERGY(nbr),CELL_GENERATION(nbr),CELL_ENERGY(nbr),0);
+				CELL_GENERATION(nbr) = 0;
+				markDirty(nbr);
+			} else if (CELL_GENERATION(nbr) > 2) {
+				tmp = energy / failedKillPenalty;
+				if (energy > tmp)
+					energy -= tmp;
+				else energy = 0;
+			}
+			cellUnlockNeighbor(cell,nbr);
+		}
+		VM_NEXT();
+op_share: /* SHARE: Equalize energy between self and neighbor if allowed */
+		nbr = getNeighbor(x,y,facing);
+		if (lockNeighbor(stats,PROFILE_SHARE,cell,nbr)) {
+			if (accessAllowed(prng,nbr,reg,1)) {
+				if (CELL_GENERATION(nbr) > 2)
+					++stats->viableCellShares;
+				tmp = energy + CELL_ENERGY(nbr);
+				accountCell(stats,CELL_ENERGY(nbr),CELL_GENERATION(nbr),tmp / 2,CELL_GENERATION(nbr));
+				CELL_MATERIALIZE(nbr);
+				CELL_ENERGY(nbr) = tmp / 2;
+				energy = tmp - CELL_ENERGY(nbr);
+				markDirty(nbr);
+			}
+			cellUnlockNeighbor(cell,nbr);
+		}
+		VM_NEXT();
+op_stop: /* STOP: End execution */
+vm_done:
+		CELL_ENERGY(cell) = energy;
+
+#undef VM_ADVANCE
+#undef VM_FETCH
+#undef VM_DISPATCH
+#undef VM_NEXT
+	}
+#else /* !USE_THREADED_DISPATCH */
+	/* Core execution loop */
+	while ((CELL_ENERGY(cell))&&(!stop)) {
+		/* Get the next instruction */
+		inst = (currentWord >> shiftPtr) & 0xf;
+
+		/* Randomly frob either the instruction or the register with a
+		 * probability defined by mutationRate. This introduces variation,
+		 * and since the variation is introduced into the state of the VM
+		 * it can have all manner of different effects on the end result of
+		 * replication: insertions, deletions, duplications of entire
+		 * ranges of the genome, etc. */
+		if (checkMutation(prng)) {
+			tmp = getRandom(prng); /* Call getRandom() only once for speed */
+			if (tmp & 0x80) /* Check for the 8th bit to get random boolean */
+				inst = tmp & 0xf; /* Only the first four bits are used here */
+			else reg = tmp & 0xf;
+		}
+
+		/* Each instruction processed costs one unit of energy */
+		--CELL_ENERGY(cell);
+
+		/* Execute the instruction */
+		if (falseLoopDepth) {
+			/* Skip forward to matching REP if we're in a false loop. */
+			PROFILE(++stats->prof.falseLoopSkipped;)
+			if (inst == 0x9) /* Increment false LOOP depth */
+				++falseLoopDepth;
+			else if (inst == 0xa) /* Decrement on REP */
+				--falseLoopDepth;
+		} else {
+			/* If we're not in a false LOOP/REP, execute normally */
+			
+			/* Keep track of execution frequencies for each instruction */
+			++stats->instructionExecutions[inst];
+			PROFILE(++profInstructions;)
+			
+			switch(inst) {
+				case 0x0: /* ZERO: Zero VM state registers */
+					reg = 0;
+					ptr_wordPtr = 0;
+					ptr_shiftPtr = 0;
+					facing = 0;
+					break;
+				case 0x1: /* FWD: Increment the pointer (wrap at end) */
+					if ((ptr_shiftPtr += 4) >= SYSWORD_BITS) {
+						if (++ptr_wordPtr >= POND_DEPTH_SYSWORDS)
+							ptr_wordPtr = 0;
+						ptr_shiftPtr = 0;
+					}
+					break;
+				case 0x2: /* BACK: Decrement the pointer (wrap at beginning) */
+					if (ptr_shiftPtr)
+						ptr_shiftPtr -= 4;
+					else {
+						if (ptr_wordPtr)
+							--ptr_wordPtr;
+						else ptr_wordPtr = POND_DEPTH_SYSWORDS - 1;
+						ptr_shiftPtr = SYSWORD_BITS - 4;
+					}
+					break;
+				case 0x3: /* INC: Increment the register */
+					reg = (reg + 1) & 0xf;
+					break;
+				case 0x4: /* DEC: Decrement the register */
+					reg = (reg - 1) & 0xf;
+					break;
+				case 0x5: /* READG: Read into the register from genome */
+					reg = (genome[ptr_wordPtr] >> ptr_shiftPtr) & 0xf;
+					break;
+				case 0x6: /* WRITEG: Write out from the register to genome */
+					genome = CELL_GENOME_W(cell);
+					CELL_GENOME_TOUCH(cell,ptr_wordPtr);
+					genome[ptr_wordPtr] &= ~(((uintptr_t)0xf) << ptr_shiftPtr);
+					genome[ptr_wordPtr] |= reg << ptr_shiftPtr;
+					if (!ptr_wordPtr)
+						CELL_SYNC_LOGO(cell);
+					invalidateLoopIndex(ctx->loops);
+					currentWord = genome[wordPtr]; /* Must refresh in case this changed! */
+					break;
+				case 0x7: /* READB: Read into the register from buffer */
+					if (ptr_wordPtr >= outputHigh)
+						touchOutput(outputBuf,&outputHigh,ptr_wordPtr);
+					reg = (outputBuf[ptr_wordPtr] >> ptr_shiftPtr) & 0xf;
+					break;
+				case 0x8: /* WRITEB: Write out from the register to buffer */
+					if (ptr_wordPtr >= outputHigh)
+						touchOutput(outputBuf,&outputHigh,ptr_wordPtr);
+					outputBuf[ptr_wordPtr] &= ~(((uintptr_t)0xf) << ptr_shiftPtr);
+					outputBuf[ptr_wordPtr] |= reg << ptr_shiftPtr;
+					break;
+				case 0x9: /* LOOP: Jump forward to matching REP if register is zero */
+					if (reg) {
+						if (loopStackPtr >= POND_DEPTH)
+							stop = 1; /* Stack overflow ends execution */
+						else {
+							loopStack_wordPtr[loopStackPtr] = wordPtr;
+							loopStack_shiftPtr[loopStackPtr] = shiftPtr;
+							++loopStackPtr;
+						}
+					} else {
+						PROFILE(++stats->prof.falseLoops;)
+						PROFILE(profEnergy = CELL_ENERGY(cell);)
+						falseLoopDepth = skipFalseLoop(ctx->loops,prng,genome,&wordPtr,&shiftPtr,&CELL_ENERGY(cell));
+						PROFILE(stats->prof.falseLoopSkipped += profEnergy - CELL_ENERGY(cell);)
+						currentWord = genome[wordPtr];
+					}
+					break;
+				case 0xa: /* REP: Jump back to matching LOOP if register is nonzero */
+					if (loopStackPtr) {
+						--loopStackPtr;
+						if (reg) {
+							wordPtr = loopStack_wordPtr[loopStackPtr];
+							shiftPtr = loopStack_shiftPtr[loopStackPtr];
+							currentWord = genome[wordPtr];
+							/* This ensures that the LOOP is rerun */
+							continue;
+						}
+					}
+					break;
+				case 0xb: /* TURN: Turn in the direction specified by register */
+					facing = reg & 3;
+					break;
+				case 0xc: /* XCHG: Skip next instruction and exchange value of register with it */
+					if ((shiftPtr += 4) >= SYSWORD_BITS) {
+						if (++wordPtr >= POND_DEPTH_SYSWORDS) {
+							wordPtr = EXEC_START_WORD;
+							shiftPtr = EXEC_START_BIT;
+						} else shiftPtr = 0;
+					}
+					tmp = reg;
+					genome = CELL_GENOME_W(cell);
+					CELL_GENOME_TOUCH(cell,wordPtr);
+					reg = (genome[wordPtr] >> shiftPtr) & 0xf;
+					genome[wordPtr] &= ~(((uintptr_t)0xf) << shiftPtr);
+					genome[wordPtr] |= tmp << shiftPtr;
+					if (!wordPtr)
+						CELL_SYNC_LOGO(cell);
+					invalidateLoopIndex(ctx->loops);
+					currentWord = genome[wordPtr];
+					break;
+				case 0xd: /* KILL: Blow away neighboring cell if allowed with penalty on failure */
+					nbr = getNeighbor(x,y,facing);
+					if (lockNeighbor(stats,PROFILE_KILL,cell,nbr)) {
+						if (accessAllowed(prng,nbr,reg,0)) {
+							if (CELL_GENERATION(nbr) > 2)
+								++stats->viableCellsKilled;
+
+							/* Filling first two words with 0xfffff... is enough */
+							CELL_MATERIALIZE(nbr);
+							CELL_GENOME_W(nbr)[0] = ~((uintptr_t)0);
+							CELL_GENOME_W(nbr)[1] = ~((uintptr_t)0);
+							CELL_SYNC_LOGO(nbr);
+							CELL_ID(nbr) = newCellId(ctx);
+							CELL_PARENT_ID(nbr) = 0;
+							CELL_LINEAGE(nbr) = CELL_ID(nbr);
+							accountCell(stats,CELL_ENERGY(nbr),CELL_GENERATION(nbr),CELL_ENERGY(nbr),0);
+							CELL_GENERATION(nbr) = 0;
+							markDirty(nbr);
+						} else if (CELL_GENERATION(nbr) > 2) {
+							tmp = CELL_ENERGY(cell) / failedKillPenalty;
+							if (CELL_ENERGY(cell) > tmp)
+								CELL_ENERGY(cell) -= tmp;
+							else CELL_ENERGY(cell) = 0;
+						}
+						cellUnlockNeighbor(cell,nbr);
+					}
+					break;
+				case 0xe: /* SHARE: Equalize energy between self and neighbor if allowed */
+					nbr = getNeighbor(x,y,facing);
+					if (lockNeighbor(stats,PROFILE_SHARE,cell,nbr)) {
+						if (accessAllowed(prng,nbr,reg,1)) {
+							if (CELL_GENERATION(nbr) > 2)
+								++stats->viableCellShares;
+							tmp = CELL_ENERGY(cell) + CELL_ENERGY(nbr);
+							accountCell(stats,CELL_ENERGY(nbr),CELL_GENERATION(nbr),tmp / 2,CELL_GENERATION(nbr));
+							CELL_MATERIALIZE(nbr);
+							CELL_ENERGY(nbr) = tmp / 2;
+							CELL_ENERGY(cell) = tmp - CELL_ENERGY(nbr);
+							markDirty(nbr);
+						}
+						cellUnlockNeighbor(cell,nbr);
+					}
+					break;
+				case 0xf: /* STOP: End execution */
+					stop = 1;
+					break;
+			}
+		}
+		
+		/* Advance the shift and word pointers, and loop around
+		 * to the beginning at the end of the genome. */
+		if ((shiftPtr += 4) >= SYSWORD_BITS) {
+			if (++wordPtr >= POND_DEPTH_SYSWORDS) {
+				wordPtr = EXEC_START_WORD;
+				shiftPtr = EXEC_START_BIT;
+			} else shiftPtr = 0;
+			currentWord = genome[wordPtr];
+		}
+	}
+#endif /* USE_THREADED_DISPATCH */
+
+	/* Copy outputBuf into neighbor if access is permitted and there
+	 * is energy there to make something happen. There is no need
+	 * to copy to a cell with no energy, since anything copied there
+	 * would never be executed and then would be replaced with random
+	 * junk eventually. See the seeding code in the main loop above. */
+	if ((outputHigh)&&((outputBuf[0] & 0xff) != 0xff)) {
+		nbr = getNeighbor(x,y,facing);
+		if (lockNeighbor(stats,PROFILE_OFFSPRING,cell,nbr)) {
+			if ((CELL_ENERGY(nbr))&&accessAllowed(prng,nbr,reg,0)) {
+				/* Log it if we're replacing a viable cell */
+				if (CELL_GENERATION(nbr) > 2)
+					++stats->viableCellsReplaced;
+				
+				CELL_ID(nbr) = newCellId(ctx);
+				CELL_PARENT_ID(nbr) = CELL_ID(cell);
+				CELL_LINEAGE(nbr) = CELL_LINEAGE(cell); /* Lineage is copied in offspring */
+				accountCell(stats,CELL_ENERGY(nbr),CELL_GENERATION(nbr),CELL_ENERGY(nbr),CELL_GENERATION(cell) + 1);
+				CELL_GENERATION(nbr) = CELL_GENERATION(cell) + 1;
+
+				CELL_SET_GENOME(nbr,outputBuf,outputHigh);
+				CELL_SYNC_LOGO(nbr);
+				markDirty(nbr);
+			}
+			cellUnlockNeighbor(cell,nbr);
+		}
+	}
+
+	accountCell(stats,startEnergy,startGeneration,CELL_ENERGY(cell),CELL_GENERATION(cell));
+	markDirty(cell);
+	PROFILE(profileExecution(stats,getCycles() - profStart,profInstructions);)
+	cellUnlock(cell);
+}
+#endif /* !USE_BATCH_ENGINE */
+
+#ifdef USE_BATCH_ENGINE
+/*
+ * Batch engine
+ *
+ * Instead of running each cell to completion, threads keep up to
+ * USE_BATCH_ENGINE cells in lanes and run them in lockstep, one
+ * instruction per lane per step; a picked cell takes a free lane, and
+ * the lanes are stepped whenever there is none. VM state lives in
+ * per-lane arrays, and each step works on all lanes at once: it fetches,
+ * mutates and pays for the instruction of every lane, runs the register
+ * and pointer instructions (ZERO, FWD, BACK, INC, DEC and TURN) as one
+ * branch-free pass over all lanes that the compiler can vectorize, runs
+ * each of the other instructions for the mask of lanes that have it, and
+ * last advances the lanes that didn't jump. A picked cell is only
+ * prefetched until the next step, so the cache misses of the cells
+ * picked in between overlap.
+ *
+ * The result doesn't depend on the number of lanes. A picked cell that
+ * is closer than three cells to one in a lane waits in its own lane for
+ * that one to finish before it starts, and inflow waits for any such lane
+ * before seeding, so no two running lanes touch the same cell and the
+ * order lanes run and finish in makes no difference. Each cell gets its
+ * own generator seeded from one draw from the thread's when it's picked,
+ * so lanes don't share a stream, and reserves the cell IDs it can hand
+ * out then too (see LANE_CELL_IDS). With CELL_LOCK_STRIPES, lanes whose
+ * cells share a stripe can fail each other's neighbor locks, which does
+ * depend on the number of lanes.
+ *
+ * Runs still differ from the one-at-a-time engine, since that runs cells
+ * from the thread's generator directly and takes IDs as it goes. False
+ * LOOPs are skipped an instruction at a time instead of via the loop
+ * index.
+ */
+
+/* Stands in for the instruction of a lane that isn't running one */
+#define BATCH_IDLE 0x10
+
+/* Cell IDs reserved for each picked cell, whether it turns out to run
+ * or not: one for each direction it can KILL in, and one for offspring.
+ * A neighbor KILLed again in the same direction gets the same ID again,
+ * as only the last one it gets is kept. */
+#define LANE_CELL_IDS 5
+#define LANE_OFFSPRING_ID 4
+
+#define LANE(l) (((uint64_t)1) << (l))
+#define ALL_LANES ((USE_BATCH_ENGINE < 64) ? (LANE(USE_BATCH_ENGINE) - 1) : ~((uint64_t)0))
+
+struct Batch
+{
+	/* Lanes with a cell, lanes with one to start at the next step, lanes
+	 * with one waiting for lanes near it to finish first, lanes running,
+	 * and lanes among those that have stopped with offspring to copy out */
+	uint64_t live;
+	uint64_t queued;
+	uint64_t blocked;
+	uint64_t active;
+	uint64_t offspring;
+
+	/* Lanes each blocked lane waits for */
+	uint64_t waitFor[USE_BATCH_ENGINE];
+
+	/* Where each lane's cell is, as 32-bit values for laneNear(), with
+	 * occupied nonzero for lanes with a cell */
+	int32_t x[USE_BATCH_ENGINE];
+	int32_t y[USE_BATCH_ENGINE];
+	int32_t occupied[USE_BATCH_ENGINE];
+	uintptr_t cell[USE_BATCH_ENGINE];
+
+	/* Seed each lane's generator is seeded from when it starts */
+	uint64_t seed[USE_BATCH_ENGINE];
+
+	/* First cell ID each lane reserved, see LANE_CELL_IDS */
+	uint64_t cellIds[USE_BATCH_ENGINE];
+
+	/* Instruction each lane runs this step, or BATCH_IDLE */
+	uint8_t op[USE_BATCH_ENGINE];
+
+	/* VM state of each lane (see execCell()), with the instruction and
+	 * memory pointers and the loop stack as nibble positions */
+	uintptr_t ip[USE_BATCH_ENGINE];
+	uintptr_t ptr[USE_BATCH_ENGINE];
+	uintptr_t reg[USE_BATCH_ENGINE];
+	uintptr_t facing[USE_BATCH_ENGINE];
+	uintptr_t energy[USE_BATCH_ENGINE];
+	uintptr_t falseLoopDepth[USE_BATCH_ENGINE];
+	uintptr_t loopStackPtr[USE_BATCH_ENGINE];
+	uintptr_t outputHigh[USE_BATCH_ENGINE];
+	uintptr_t startEnergy[USE_BATCH_ENGINE];
+	uintptr_t startGeneration[USE_BATCH_ENGINE];
+#ifdef USE_PROFILING
+	uintptr_t instructions[USE_BATCH_ENGINE];
+#endif
+	struct PRNG prng[USE_BATCH_ENGINE];
+	uint32_t loopStack[USE_BATCH_ENGINE][POND_DEPTH];
+	CACHE_ALIGNED uintptr_t outputBuf[USE_BATCH_ENGINE][POND_DEPTH_SYSWORDS];
+};
+
+static struct Batch *batches;
+
+/* Word and shift of a nibble position */
+#define NIBBLE_WORD(q) ((q) / SYSWORD_NIBBLES)
+#define NIBBLE_SHIFT(q) (((q) % SYSWORD_NIBBLES) * 4)
+
+/* The k'th cell ID a lane reserved */
+#define LANE_CELL_ID(ctx,b,l,k) ((b)->cellIds[(l)] + ((uint64_t)(k) * (ctx)->cellIdStep))
+
+/* Runs a lane's KILL */
+static inline void killLane(const struct ExecContext *const ctx,struct Batch *const b,const uintptr_t l)
+{
+	struct StatCounters *const stats = ctx->stats;
+	const uintptr_t cell = b->cell[l];
+	const uintptr_t nbr = getNeighbor((uintptr_t)b->x[l],(uintptr_t)b->y[l],b->facing[l]);
+	uintptr_t tmp;
+
+	if (lockNeighbor(stats,PROFILE_KILL,cell,nbr)) {
+		if (accessAllowed(&b->prng[l],nbr,b->reg[l],0)) {
+			if (CELL_GENERATION(nbr) > 2)
+				++stats->viableCellsKilled;
+			CELL_MATERIALIZE(nbr);
+			CELL_GENOME_W(nbr)[0] = ~((uintptr_t)0);
+			CELL_GENOME_W(nbr)[1] = ~((uintptr_t)0);
+			CELL_SYNC_LOGO(nbr);
+			CELL_ID(nbr) = LANE_CELL_ID(ctx,b,l,b->facing[l]);
+			CELL_PARENT_ID(nbr) = 0;
+			CELL_LINEAGE(nbr) = CELL_ID(nbr);
+			accountCell(stats,CELL_ENERGY(nbr),CELL_GENERATION(nbr),CELL_ENERGY(nbr),0);
+			CELL_GENERATION(nbr) = 0;
+			markDirty(nbr);
+		} else if (CELL_GENERATION(nbr) > 2) {
+			tmp = b->energy[l] / failedKillPenalty;
+			if (b->energy[l] > tmp)
+				b->energy[l] -= tmp;
+			else b->energy[l] = 0;
+		}
+		cellUnlockNeighbor(cell,nbr);
+	}
+}
+
+/* Runs a lane's SHARE */
+static inline void shareLane(const struct ExecContext *const ctx,struct Batch *const b,const uintptr_t l)
+{
+	struct StatCounters *const stats = ctx->stats;
+	const uintptr_t cell = b->cell[l];
+	const uintptr_t nbr = getNeighbor((uintptr_t)b->x[l],(uintptr_t)b->y[l],b->facing[l]);
+	uintptr_t tmp;
+
+	if (lockNeighbor(stats,PROFILE_SHARE,cell,nbr)) {
+		if (accessAllowed(&b->prng[l],nbr,b->reg[l],1)) {
+			if (CELL_GENERATION(nbr) > 2)
+				++stats->viableCellShares;
+			tmp = b->energy[l] + CELL_ENERGY(nbr);
+			accountCell(stats,CELL_ENERGY(nbr),CELL_GENERATION(nbr),tmp / 2,CELL_GENERATION(nbr));
+			CELL_MATERIALIZE(nbr);
+			CELL_ENERGY(nbr) = tmp / 2;
+			b->energy[l] = tmp - CELL_ENERGY(nbr);
+			markDirty(nbr);
+		}
+		cellUnlockNeighbor(cell,nbr);
+	}
+}
+
+/* Frees a lane, queueing any blocked lane that waited for it last */
+static inline void freeLane(struct Batch *const b,const uintptr_t l)
+{
+	uint64_t m;
+	uintptr_t k;
+
+	b->op[l] = BATCH_IDLE;
+	b->occupied[l] = 0;
+	b->live &= ~LANE(l);
+	b->offspring &= ~LANE(l);
+	for(m=b->blocked;m;m&=m-1) {
+		k = (uintptr_t)__builtin_ctzll(m);
+		if (!(b->waitFor[k] &= ~LANE(l))) {
+			b->blocked &= ~LANE(k);
+			b->queued |= LANE(k);
+		}
+	}
+}
+
+/* Finishes a lane's cell: stores its energy, copies out any offspring,
+ * unlocks it and frees the lane */
+static void finishLane(const struct ExecContext *const ctx,struct Batch *const b,const uintptr_t l)
+{
+	struct StatCounters *const stats = ctx->stats;
+	const uintptr_t cell = b->cell[l];
+	const uintptr_t *const outputBuf = b->outputBuf[l];
+	uintptr_t nbr;
+
+	CELL_ENERGY(cell) = b->energy[l];
+
+	if (b->offspring & LANE(l)) {
+		nbr = getNeighbor((uintptr_t)b->x[l],(uintptr_t)b->y[l],b->facing[l]);
+		if (lockNeighbor(stats,PROFILE_OFFSPRING,cell,nbr)) {
+			if ((CELL_ENERGY(nbr))&&accessAllowed(&b->prng[l],nbr,b->reg[l],0)) {
+				if (CELL_GENERATION(nbr) > 2)
+					++stats->viableCellsReplaced;
+				CELL_ID(nbr) = LANE_CELL_ID(ctx,b,l,LANE_OFFSPRING_ID);
+				CELL_PARENT_ID(nbr) = CELL_ID(cell);
+				CELL_LINEAGE(nbr) = CELL_LINEAGE(cell);
+				accountCell(stats,CELL_ENERGY(nbr),CELL_GENERATION(nbr),CELL_ENERGY(nbr),CELL_GENERATION(cell) + 1);
+				CELL_GENERATION(nbr) = CELL_GENERATION(cell) + 1;
+				CELL_SET_GENOME(nbr,outputBuf,b->outputHigh[l]);
+				CELL_SYNC_LOGO(nbr);
+				markDirty(nbr);
+			}
+			cellUnlockNeighbor(cell,nbr);
+		}
+	}
+
+	accountCell(stats,b->startEnergy[l],b->startGeneration[l],CELL_ENERGY(cell),CELL_GENERATION(cell));
+	markDirty(cell);
+	PROFILE(profileExecution(stats,0,b->instructions[l]);)
+	cellUnlock(cell);
+	freeLane(b,l);
+}
+
+/**
+ * Starts the cells queued in lanes
+ *
+ * A cell with no energy, or one another thread has locked, frees its
+ * lane again. Checking only now gives the loads of the cells picked
+ * since the last step time to overlap.
+ *
+ * @param ctx Execution context
+ */
+static void startLanes(const struct ExecContext *const ctx)
+{
+	struct Batch *const b = ctx->batch;
+	uintptr_t l,cell;
+	uint64_t m;
+
+	m = b->queued;
+	b->queued = 0;
+	for(;m;m&=m-1) {
+		l = (uintptr_t)__builtin_ctzll(m);
+		cell = b->cell[l];
+		if ((deadCell(ctx->stats,cell))||(!cellTryLock(cell))) {
+			freeLane(b,l);
+			continue;
+		}
+		seedRandom(&b->prng[l],b->seed[l],0);
+		b->op[l] = BATCH_IDLE;
+		b->ip[l] = (EXEC_START_WORD * SYSWORD_NIBBLES) + (EXEC_START_BIT / 4);
+		b->ptr[l] = 0;
+		b->reg[l] = 0;
+		b->facing[l] = 0;
+		b->energy[l] = b->startEnergy[l] = CELL_ENERGY(cell);
+		b->startGeneration[l] = CELL_GENERATION(cell);
+		b->falseLoopDepth[l] = 0;
+		b->loopStackPtr[l] = 0;
+		b->outputHigh[l] = 0;
+		PROFILE(b->instructions[l] = 0;)
+		++ctx->stats->cellExecutions;
+		if (b->energy[l])
+			b->active |= LANE(l);
+		else finishLane(ctx,b,l); /* Another thread took its energy */
+	}
+}
+
+/**
+ * Runs one instruction of every running lane, starting any queued first
+ *
+ * @param ctx Execution context
+ */
+static void stepBatch(const struct ExecContext *const ctx)
+{
+	struct Batch *const b = ctx->batch;
+	struct StatCounters *const stats = ctx->stats;
+	uintptr_t l,inst,tmp,cell,w,s;
+	uintptr_t *genome;
+	uint64_t opMask[16];
+	uint64_t run = 0,advance = 0,ended,m;
+	PROFILE(const uint64_t profStart = getCycles();)
+
+	startLanes(ctx);
+
+	/* Fetch, mutate and pay for the next instruction of each lane. Lanes
+	 * skipping a false LOOP only track its depth. */
+	memset(opMask,0,sizeof(opMask));
+	for(m=b->active;m;m&=m-1) {
+		l = (uintptr_t)__builtin_ctzll(m);
+		inst = (CELL_GENOME(b->cell[l])[NIBBLE_WORD(b->ip[l])] >> NIBBLE_SHIFT(b->ip[l])) & 0xf;
+		if (checkMutation(&b->prng[l])) {
+			tmp = getRandom(&b->prng[l]);
+			if (tmp & 0x80)
+				inst = tmp & 0xf;
+			else b->reg[l] = tmp & 0xf;
+		}
+		--b->energy[l];
+		if (b->falseLoopDepth[l]) {
+			PROFILE(++stats->prof.falseLoopSkipped;)
+			if (inst == 0x9)
+				++b->falseLoopDepth[l];
+			else if (inst == 0xa)
+				--b->falseLoopDepth[l];
+			b->op[l] = BATCH_IDLE;
+			advance |= LANE(l);
+		} else {
+			++stats->instructionExecutions[inst];
+			PROFILE(++b->instructions[l];)
+			b->op[l] = (uint8_t)inst;
+			opMask[inst] |= LANE(l);
+			run |= LANE(l);
+		}
+	}
+
+	/* Register and pointer instructions, for all lanes at once */
+	for(l=0;l<USE_BATCH_ENGINE;++l) {
+		const uintptr_t op = b->op[l];
+		const uintptr_t reg = b->reg[l];
+		const uintptr_t ptr = b->ptr[l];
+		b->reg[l] = (op == 0x0) ? 0 : ((op == 0x3) ? ((reg + 1) & 0xf) : ((op == 0x4) ? ((reg - 1) & 0xf) : reg));
+		b->ptr[l] = (op == 0x0) ? 0 : ((op == 0x1) ? (((ptr + 1) < POND_DEPTH) ? (ptr + 1) : 0) : ((op == 0x2) ? ((ptr) ? (ptr - 1) : (POND_DEPTH - 1)) : ptr));
+		b->facing[l] = (op == 0x0) ? 0 : ((op == 0xb) ? (reg & 3) : b->facing[l]);
+	}
+
+	/* The rest, an instruction at a time for the lanes that have it */
+	ended = opMask[0xf]; /* STOP */
+	for(m=opMask[0x5];m;m&=m-1) { /* READG */
+		l = (uintptr_t)__builtin_ctzll(m);
+		b->reg[l] = (CELL_GENOME(b->cell[l])[NIBBLE_WORD(b->ptr[l])] >> NIBBLE_SHIFT(b->ptr[l])) & 0xf;
+	}
+	for(m=opMask[0x6];m;m&=m-1) { /* WRITEG */
+		l = (uintptr_t)__builtin_ctzll(m);
+		cell = b->cell[l];
+		w = NIBBLE_WORD(b->ptr[l]);
+		s = NIBBLE_SHIFT(b->ptr[l]);
+		genome = CELL_GENOME_W(cell);
+		CELL_GENOME_TOUCH(cell,w);
+		genome[w] &= ~(((uintptr_t)0xf) << s);
+		genome[w] |= b->reg[l] << s;
+		if (!w)
+			CELL_SYNC_LOGO(cell);
+	}
+	for(m=opMask[0x7]|opMask[0x8];m;m&=m-1) { /* READB and WRITEB */
+		l = (uintptr_t)__builtin_ctzll(m);
+		w = NIBBLE_WORD(b->ptr[l]);
+		s = NIBBLE_SHIFT(b->ptr[l]);
+		if (w >= b->outputHigh[l])
+			touchOutput(b->outputBuf[l],&b->outputHigh[l],w);
+		if (b->op[l] == 0x7)
+			b->reg[l] = (b->outputBuf[l][w] >> s) & 0xf;
+		else {
+			b->outputBuf[l][w] &= ~(((uintptr_t)0xf) << s);
+			b->outputBuf[l][w] |= b->reg[l] << s;
+		}
+	}
+	for(m=opMask[0x9];m;m&=m-1) { /* LOOP */
+		l = (uintptr_t)__builtin_ctzll(m);
+		if (b->reg[l]) {
+			if (b->loopStackPtr[l] >= POND_DEPTH)
+				ended |= LANE(l); /* Stack overflow ends execution */
+			else b->loopStack[l][b->loopStackPtr[l]++] = (uint32_t)b->ip[l];
+		} else {
+			PROFILE(++stats->prof.falseLoops;)
+			b->falseLoopDepth[l] = 1;
+		}
+	}
+	advance |= run & ~ended;
+	for(m=opMask[0xa];m;m&=m-1) { /* REP */
+		l = (uintptr_t)__builtin_ctzll(m);
+		if (b->loopStackPtr[l]) {
+			--b->loopStackPtr[l];
+			if (b->reg[l]) {
+				b->ip[l] = b->loopStack[l][b->loopStackPtr[l]];
+				advance &= ~LANE(l); /* This ensures that the LOOP is rerun */
+			}
+		}
+	}
+	for(m=opMask[0xc];m;m&=m-1) { /* XCHG */
+		l = (uintptr_t)__builtin_ctzll(m);
+		cell = b->cell[l];
+		b->ip[l] = NEXT_NIBBLE(b->ip[l]);
+		w = NIBBLE_WORD(b->ip[l]);
+		s = NIBBLE_SHIFT(b->ip[l]);
+		tmp = b->reg[l];
+		genome = CELL_GENOME_W(cell);
+		CELL_GENOME_TOUCH(cell,w);
+		b->reg[l] = (genome[w] >> s) & 0xf;
+		genome[w] &= ~(((uintptr_t)0xf) << s);
+		genome[w] |= tmp << s;
+		if (!w)
+			CELL_SYNC_LOGO(cell);
+	}
+	for(m=opMask[0xd];m;m&=m-1) /* KILL */
+		killLane(ctx,b,(uintptr_t)__builtin_ctzll(m));
+	for(m=opMask[0xe];m;m&=m-1) /* SHARE */
+		shareLane(ctx,b,(uintptr_t)__builtin_ctzll(m));
+
+	/* Advance the lanes that didn't jump */
+	for(m=advance;m;m&=m-1) {
+		l = (uintptr_t)__builtin_ctzll(m);
+		b->ip[l] = NEXT_NIBBLE(b->ip[l]);
+	}
+
+	/* Lanes that stopped or ran out of energy are done */
+	for(m=b->active&~ended;m;m&=m-1) {
+		l = (uintptr_t)__builtin_ctzll(m);
+		if (!b->energy[l])
+			ended |= LANE(l);
+	}
+	for(m=ended;m;m&=m-1) {
+		l = (uintptr_t)__builtin_ctzll(m);
+		if ((b->outputHigh[l])&&((b->outputBuf[l][0] & 0xff) != 0xff))
+			b->offspring |= LANE(l);
+		finishLane(ctx,b,l);
+	}
+	b->active &= ~ended;
+
+	/* Lanes run interleaved, so only steps as a whole are timed */
+	PROFILE(stats->prof.cycles += getCycles() - profStart;)
+}
+
+/* Runs all lanes to completion */
+static void flushBatch(const struct ExecContext *const ctx)
+{
+	while (ctx->batch->live)
+		stepBatch(ctx);
+}
+
+/* Distance between a lane's cell and a cell, the short way round */
+static inline int32_t laneDistance(const struct Batch *const b,const uintptr_t l,const uintptr_t x,const uintptr_t y)
+{
+	const int32_t sizeX = (int32_t)pondSizeX;
+	const int32_t sizeY = (int32_t)pondSizeY;
+	int32_t dx = (int32_t)x - b->x[l];
+	int32_t dy = (int32_t)y - b->y[l];
+	dx = (dx < 0) ? -dx : dx;
+	dy = (dy < 0) ? -dy : dy;
+	dx = (dx > (sizeX - dx)) ? (sizeX - dx) : dx;
+	dy = (dy > (sizeY - dy)) ? (sizeY - dy) : dy;
+	return dx + dy;
+}
+
+/**
+ * Checks whether any lane has a cell within two cells of a cell (both
+ * could touch a cell between them)
+ *
+ * This is made for every cell picked and lanes are hardly ever near, so
+ * it's a branch-free pass over all lanes in 32-bit arithmetic that the
+ * compiler can vectorize; nearLanes() then says which.
+ *
+ * @param b Batch
+ * @param x X coordinate of cell
+ * @param y Y coordinate of cell
+ * @return Nonzero if a lane is near
+ */
+static inline int laneNear(const struct Batch *const b,const uintptr_t x,const uintptr_t y)
+{
+	int32_t near = 0;
+	uintptr_t l;
+	for(l=0;l<USE_BATCH_ENGINE;++l)
+		near |= (laneDistance(b,l,x,y) <= 2) & b->occupied[l];
+	return near;
+}
+
+/* Returns the mask of lanes laneNear() finds near a cell */
+static uint64_t nearLanes(const struct Batch *const b,const uintptr_t x,const uintptr_t y)
+{
+	uint64_t near = 0,m;
+	uintptr_t l;
+	for(m=b->live;m;m&=m-1) {
+		l = (uintptr_t)__builtin_ctzll(m);
+		if (laneDistance(b,l,x,y) <= 2)
+			near |= LANE(l);
+	}
+	return near;
+}
+
+/**
+ * Queues a cell in a lane to run
+ *
+ * Lanes are stepped first until one is free. The cell's energy is only
+ * prefetched now (most cells picked have none, so the rest of the cell
+ * isn't), and checked and the cell started at the next step, or once
+ * the lanes near it (see laneNear()) have finished; the seed for its
+ * generator and its cell IDs are taken now, in the order cells are
+ * picked.
+ *
+ * @param ctx Execution context
+ * @param x X coordinate of cell
+ * @param y Y coordinate of cell
+ */
+static void queueCell(const struct ExecContext *const ctx,const uintptr_t x,const uintptr_t y)
+{
+	struct Batch *const b = ctx->batch;
+	const uintptr_t cell = CELL_INDEX(x,y);
+	uintptr_t l;
+
+	while (b->live == ALL_LANES)
+		stepBatch(ctx);
+
+	l = (uintptr_t)__builtin_ctzll(~b->live);
+	if (laneNear(b,x,y)) {
+		b->waitFor[l] = nearLanes(b,x,y);
+		b->blocked |= LANE(l);
+	} else b->queued |= LANE(l);
+	b->live |= LANE(l);
+	b->x[l] = (int32_t)x;
+	b->y[l] = (int32_t)y;
+	b->occupied[l] = 1;
+	b->cell[l] = cell;
+	b->seed[l] = (uint64_t)getRandom(ctx->prng);
+	b->cellIds[l] = newCellIds(ctx,LANE_CELL_IDS);
+	__builtin_prefetch(&CELL_ENERGY(cell),1);
+}
+
+/**
+ * Seeds a cell as seedCell() does, once no lane is near it
+ *
+ * With more than one thread all lanes are run first instead, as
+ * seedCell() waits for the cell's lock and mustn't while lanes hold
+ * theirs.
+ *
+ * @param ctx Execution context
+ * @param x X coordinate of cell
+ * @param y Y coordinate of cell
+ */
+static void queueSeed(const struct ExecContext *const ctx,const uintptr_t x,const uintptr_t y)
+{
+#ifdef USE_CELL_LOCKS
+	if (threadCount > 1) {
+		flushBatch(ctx);
+		seedCell(ctx,x,y);
+		return;
+	}
+#endif
+	while (laneNear(ctx->batch,x,y))
+		stepBatch(ctx);
+	seedCell(ctx,x,y);
+}
+
+#define RUN_CELL(ctx,x,y) queueCell((ctx),(x),(y))
+#define SEED_CELL(ctx,x,y) queueSeed((ctx),(x),(y))
+#define FLUSH_CELLS(ctx) flushBatch(ctx)
+#else /* !USE_BATCH_ENGINE */
+#define RUN_CELL(ctx,x,y) execCell((ctx),(x),(y))
+#define SEED_CELL(ctx,x,y) seedCell((ctx),(x),(y))
+#define FLUSH_CELLS(ctx) ((void)0)
+#endif /* USE_BATCH_ENGINE */
+
+#ifdef USE_TILED_SCHEDULER
+/* State of the tiled scheduler, see runTiled() */
+
+#if (TILES_X % 2) || (TILES_Y % 2)
+#error TILES_X and TILES_Y must be even
+#endif
+
+#define TILE_COUNT (TILES_X * TILES_Y)
+
+/* Ticks one phase of the tiled scheduler adds to the total */
+#define PHASE_TICKS (TILE_PHASE_TICKS * (TILE_COUNT / 4))
+
+struct CACHE_ALIGNED Tile
+{
+	struct PRNG prng;
+
+	/* Cell IDs taken by this tile are congruent to its index modulo
+	 * TILE_COUNT */
+	volatile uint64_t cellIdCounter;
+
+	/* Ticks this tile has run, which paces its inflow */
+	uint64_t clock;
+};
+
+static struct Tile tiles[TILE_COUNT];
+#ifdef USE_GPU_ENGINE
+#pragma omp declare target(tiles)
+#endif
+#endif /* USE_TILED_SCHEDULER */
+
+/* Clock the schedulers start from: per thread ticks for the random
+ * scheduler, total ticks for the tiled one. Nonzero after a restore. */
+static uint64_t startClock = 0;
+
+/* Clock thread 0 stopped at, in the same units */
+static uint64_t stopClock = 0;
+
+/*
+ * Pausing threads
+ *
+ * With the random scheduler other threads keep running while thread 0
+ * reports, so anything that needs the pond at rest (like a checkpoint)
+ * has thread 0 call pauseThreads(). The others stop at their next
+ * pausePoint() between cells until resumeThreads(). A thread with cells
+ * still in batch lanes runs them to completion first, when
+ * pausePending() says a pause is coming, so that paused threads hold no
+ * cells half run. Threads that have finished are parked, which counts
+ * as paused. The tiled scheduler
+ * doesn't need any of this since thread 0 reports between phases.
+ */
+#ifdef USE_CELL_LOCKS
+static volatile int pauseRequested = 0;
+static uintptr_t pausedThreads = 0;
+static uintptr_t parkedThreads = 0;
+
+static void pauseThreads()
+{
+	uintptr_t spins = 0;
+	__atomic_store_n(&pauseRequested,1,__ATOMIC_SEQ_CST);
+	while ((__atomic_load_n(&pausedThreads,__ATOMIC_ACQUIRE) + __atomic_load_n(&parkedThreads,__ATOMIC_ACQUIRE)) < (threadCount - 1))
+		spinBackoff(&spins);
+}
+
+static void resumeThreads()
+{
+	uintptr_t spins = 0;
+	__atomic_store_n(&pauseRequested,0,__ATOMIC_RELEASE);
+	while (__atomic_load_n(&pausedThreads,__ATOMIC_ACQUIRE))
+		spinBackoff(&spins);
+}
+
+static inline int pausePending()
+{
+	return __atomic_load_n(&pauseRequested,__ATOMIC_RELAXED);
+}
+
+static inline void pausePoint()
+{
+	uintptr_t spins = 0;
+	if (__atomic_load_n(&pauseRequested,__ATOMIC_RELAXED)) {
+		__atomic_add_fetch(&pausedThreads,1,__ATOMIC_ACQ_REL);
+		while (__atomic_load_n(&pauseRequested,__ATOMIC_ACQUIRE))
+			spinBackoff(&spins);
+		__atomic_sub_fetch(&pausedThreads,1,__ATOMIC_ACQ_REL);
+	}
+}
+
+static void parkThread()
+{
+	__atomic_add_fetch(&parkedThreads,1,__ATOMIC_ACQ_REL);
+}
+#else
+#define pauseThreads() ((void)0)
+#define resumeThreads() ((void)0)
+#define pausePending() (0)
+#define pausePoint() ((void)0)
+#define parkThread() ((void)0)
+#endif /* USE_CELL_LOCKS */
+
+/*
+ * Checkpoints
+ *
+ * A checkpoint file is a header followed by blocks holding exact images
+ * of the generator state and of the pond's memory, each starting on a
+ * CHECKPOINT_ALIGN boundary. Saving is one pwrite() per block, and
+ * restoring maps the pond blocks copy-on-write right over pond memory,
+ * so a restored run starts at once and pages come in as cells touch
+ * them. Files are only portable between builds with the same pond
+ * layout, scheduler, word size and POND_DEPTH, which the header records.
+ *
+ * Periodic checkpoints are written by a fork()ed child from its copy on
+ * write image of the process, so the simulation only stops long enough
+ * to fork. Files are written under a temporary name and renamed into
+ * place, so a crash never leaves a partial checkpoint behind (and a
+ * mapping of the previous one stays valid).
+ *
+ * With the genome store cells only hold pointers to genome blocks, so
+ * the genome of every cell is written out after the other blocks, as if
+ * the pond held them itself. A restore points every cell back at the
+ * empty genome and interns the genomes read in, which rebuilds the
+ * store with every genome shared that can be.
+ */
+
+#define CHECKPOINT_MAGIC 0x444e4f504f4e414eULL /* "NANOPOND" */
+#define CHECKPOINT_VERSION 3
+#define CHECKPOINT_ALIGN 65536
+
+#define CHECKPOINT_LAYOUT_SOA 1
+#define CHECKPOINT_LAYOUT_TILED 2
+#define CHECKPOINT_LAYOUT_GENOME_STORE 4
+#if defined(USE_SOA_POND) && defined(USE_GENOME_STORE)
+#define CHECKPOINT_LAYOUT_POND (CHECKPOINT_LAYOUT_SOA | CHECKPOINT_LAYOUT_GENOME_STORE)
+#elif defined(USE_SOA_POND)
+#define CHECKPOINT_LAYOUT_POND CHECKPOINT_LAYOUT_SOA
+#elif defined(USE_GENOME_STORE)
+#define CHECKPOINT_LAYOUT_POND CHECKPOINT_LAYOUT_GENOME_STORE
+#else
+#define CHECKPOINT_LAYOUT_POND 0
+#endif
+#ifdef USE_TILED_SCHEDULER
+#define CHECKPOINT_LAYOUT (CHECKPOINT_LAYOUT_POND | CHECKPOINT_LAYOUT_TILED)
+#else
+#define CHECKPOINT_LAYOUT CHECKPOINT_LAYOUT_POND
+#endif
+
+struct CheckpointHeader
+{
+	uint64_t magic;
+	uint32_t version;
+	uint32_t layout;
+	uint64_t wordSize;
+	uint64_t pondDepth;
+	uint64_t sizeX;
+	uint64_t sizeY;
+
+	/* Ticks run so far, see startClock */
+	uint64_t clock;
+
+	/* Global cell ID counter (random scheduler only) */
+	uint64_t cellIdCounter;
+
+	/* Number of generators (random scheduler) or tiles saved */
+	uint64_t generators;
+};
+
+struct CheckpointBlock
+{
+	void *ptr;
+	size_t size;
+};
+
+#define CHECKPOINT_MAX_BLOCKS 9
+
+/* Name of checkpoint file, or null for none */
+static const char *checkpointFile = (const char *)0;
+
+/* Child writing the last periodic checkpoint, or 0 if none */
+static pid_t checkpointChild = 0;
+
+/* Gets the blocks that make up a checkpoint after its header */
+static uintptr_t getCheckpointBlocks(struct CheckpointBlock *const b,const uint64_t generators)
+{
+	uintptr_t n = 0;
+#ifdef USE_TILED_SCHEDULER
+	(void)generators;
+	b[n].ptr = (void *)tiles; b[n++].size = sizeof(tiles);
+#else
+	b[n].ptr = (void *)prngState; b[n++].size = sizeof(struct PRNG) * generators;
+#endif
+#ifdef USE_SOA_POND
+	b[n].ptr = (void *)pondID; b[n++].size = sizeof(uint64_t) * POND_SIZE;
+	b[n].ptr = (void *)pondParentID; b[n++].size = sizeof(uint64_t) * POND_SIZE;
+	b[n].ptr = (void *)pondLineage; b[n++].size = sizeof(uint64_t) * POND_SIZE;
+	b[n].ptr = (void *)pondGeneration; b[n++].size = sizeof(uintptr_t) * POND_SIZE;
+	b[n].ptr = (void *)pondEnergy; b[n++].size = sizeof(uintptr_t) * POND_SIZE;
+#ifndef USE_GENOME_STORE
+	b[n].ptr = (void *)pondGenome; b[n++].size = sizeof(uintptr_t) * POND_DEPTH_SYSWORDS * POND_SIZE;
+#endif
+	b[n].ptr = (void *)pondGenomeHigh; b[n++].size = sizeof(uint16_t) * POND_SIZE;
+	b[n].ptr = (void *)pondLogo; b[n++].size = POND_SIZE;
+#else
+	b[n].ptr = (void *)pond; b[n++].size = sizeof(struct Cell) * POND_SIZE;
+#endif
+	return n;
+}
+
+/* Offset in the file of the block after one at offset with size */
+static inline uint64_t nextCheckpointOffset(const uint64_t offset,const uint64_t size)
+{
+	return (offset + size + (CHECKPOINT_ALIGN - 1)) & ~((uint64_t)(CHECKPOINT_ALIGN - 1));
+}
+
+/* Writes all of buf at offset, returning zero on failure */
+static int pwriteAll(const int fd,const void *buf,size_t size,uint64_t offset)
+{
+	ssize_t n;
+	while (size) {
+		n = pwrite(fd,buf,size,(off_t)offset);
+		if (n <= 0)
+			return 0;
+		buf = (const void *)((const char *)buf + n);
+		size -= (size_t)n;
+		offset += (uint64_t)n;
+	}
+	return 1;
+}
+
+#ifdef USE_GENOME_STORE
+/* Genomes are written and read this many cells at a time */
+#define CHECKPOINT_GENOME_CELLS 64
+
+/* Writes the genome of every cell at offset, returning zero on failure */
+static int writeCheckpointGenomes(const int fd,uint64_t offset)
+{
+	uintptr_t buf[CHECKPOINT_GENOME_CELLS * POND_DEPTH_SYSWORDS];
+	uintptr_t c,n = 0;
+	for(c=0;c<POND_SIZE;++c) {
+		memcpy(buf + (n * POND_DEPTH_SYSWORDS),CELL_GENOME(c),sizeof(uintptr_t) * POND_DEPTH_SYSWORDS);
+		if ((++n == CHECKPOINT_GENOME_CELLS)||(c == (POND_SIZE - 1))) {
+			if (!pwriteAll(fd,buf,sizeof(uintptr_t) * POND_DEPTH_SYSWORDS * n,offset))
+				return 0;
+			offset += sizeof(uintptr_t) * POND_DEPTH_SYSWORDS * n;
+			n = 0;
+		}
+	}
+	return 1;
+}
+
+/* Reads the genome of every cell from offset into the store, returning
+ * zero on failure */
+static int readCheckpointGenomes(const int fd,uint64_t offset)
+{
+	uintptr_t *const buf = (uintptr_t *)malloc(sizeof(uintptr_t) * POND_DEPTH_SYSWORDS * CHECKPOINT_GENOME_CELLS);
+	uintptr_t c,i,n;
+	size_t size;
+	int ok = (buf != (uintptr_t *)0);
+	for(c=0;(ok)&&(c<POND_SIZE);c+=n) {
+		n = ((POND_SIZE - c) < CHECKPOINT_GENOME_CELLS) ? (POND_SIZE - c) : CHECKPOINT_GENOME_CELLS;
+		size = sizeof(uintptr_t) * POND_DEPTH_SYSWORDS * n;
+		ok = (pread(fd,buf,size,(off_t)offset) == (ssize_t)size);
+		offset += size;
+		for(i=0;(ok)&&(i<n);++i) {
+			/* The block pointer saved is meaningless now */
+			CELL_GENOME_REF(c + i) = emptyGenome;
+			CELL_SET_GENOME(c + i,buf + (i * POND_DEPTH_SYSWORDS),(uintptr_t)CELL_GENOME_HIGH(c + i));
+		}
+	}
+	free(buf);
+	return ok;
+}
+#endif /* USE_GENOME_STORE */
+
+/**
+ * Writes a checkpoint of the pond, which must be at rest
+ *
+ * This only uses async-signal-safe calls so it can run in a child
+ * forked from a threaded process.
+ *
+ * @param clock Ticks run so far, see startClock
+ * @return Nonzero on success
+ */
+static int writeCheckpoint(const uint64_t clock)
+{
+	char tmpName[4096];
+	struct CheckpointHeader h;
+	struct CheckpointBlock b[CHECKPOINT_MAX_BLOCKS];
+	uintptr_t i,n,len;
+	uint64_t offset;
+	int fd,ok;
+
+	for(len=0;checkpointFile[len];++len) {
+		if (len >= (sizeof(tmpName) - 5))
+			return 0;
+		tmpName[len] = checkpointFile[len];
+	}
+	memcpy(tmpName + len,".tmp",5);
+
+	memset(&h,0,sizeof(h));
+	h.magic = CHECKPOINT_MAGIC;
+	h.version = CHECKPOINT_VERSION;
+	h.layout = CHECKPOINT_LAYOUT;
+	h.wordSize = sizeof(uintptr_t);
+	h.pondDepth = POND_DEPTH;
+	h.sizeX = pondSizeX;
+	h.sizeY = pondSizeY;
+	h.clock = clock;
+	h.cellIdCounter = cellIdCounter;
+#ifdef USE_TILED_SCHEDULER
+	h.generators = TILE_COUNT;
+#else
+	h.generators = threadCount;
+#endif
+
+	fd = open(tmpName,O_WRONLY|O_CREAT|O_TRUNC,0644);
+	if (fd < 0)
+		return 0;
+	ok = pwriteAll(fd,&h,sizeof(h),0);
+	n = getCheckpointBlocks(b,h.generators);
+	offset = nextCheckpointOffset(0,sizeof(h));
+	for(i=0;(ok)&&(i<n);++i) {
+		ok = pwriteAll(fd,b[i].ptr,b[i].size,offset);
+		offset = nextCheckpointOffset(offset,b[i].size);
+	}
+#ifdef USE_GENOME_STORE
+	if (ok)
+		ok = writeCheckpointGenomes(fd,offset);
+#endif
+	if (ok)
+		ok = (fsync(fd) == 0);
+	if (close(fd))
+		ok = 0;
+	if (ok)
+		ok = (rename(tmpName,checkpointFile) == 0);
+	else unlink(tmpName);
+	return ok;
+}
+
+/* Waits for (if wait is nonzero) or checks on a background checkpoint */
+static void reapCheckpoint(const int wait)
+{
+	int status;
+	if (checkpointChild > 0) {
+		const pid_t r = waitpid(checkpointChild,&status,wait ? 0 : WNOHANG);
+		if (r == checkpointChild) {
+			if ((!WIFEXITED(status))||(WEXITSTATUS(status)))
+				fprintf(stderr,"[CHECKPOINT] *** Writing %s failed ***\n",checkpointFile);
+			checkpointChild = 0;
+		} else if (r < 0) {
+			checkpointChild = 0;
+		}
+	}
+}
+
+/**
+ * Starts writing a checkpoint in the background
+ *
+ * This is called by thread 0, and pauses other threads only while
+ * forking. If the previous checkpoint is still being written this one is
+ * skipped.
+ *
+ * @param clock Ticks run so far, see startClock
+ */
+static void startCheckpoint(const uint64_t clock)
+{
+	pid_t pid;
+	reapCheckpoint(0);
+	if (checkpointChild) {
+		fprintf(stderr,"[CHECKPOINT] Still writing the last checkpoint, skipping this one\n");
+		return;
+	}
+	pauseThreads();
+	pid = fork();
+	if (pid == 0)
+		_exit(writeCheckpoint(clock) ? 0 : 1);
+	resumeThreads();
+	if (pid > 0)
+		checkpointChild = pid;
+	else if (!writeCheckpoint(clock)) /* Can't fork, so just do it here */
+		fprintf(stderr,"[CHECKPOINT] *** Writing %s failed ***\n",checkpointFile);
+}
+
+/**
+ * Reads a checkpoint header and sets up the pond geometry to match
+ *
+ * @param path Checkpoint file
+ * @param h Header to fill in
+ * @return Open file descriptor for restoreCheckpoint()
+ */
+static int openCheckpoint(const char *const path,struct CheckpointHeader *const h)
+{
+	const int fd = open(path,O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr,"*** Unable to open checkpoint %s ***\n",path);
+		exit(1);
+	}
+	if ((pread(fd,h,sizeof(struct CheckpointHeader),0) != (ssize_t)sizeof(struct CheckpointHeader))||(h->magic != CHECKPOINT_MAGIC)) {
+		fprintf(stderr,"*** %s is not a nanopond checkpoint ***\n",path);
+		exit(1);
+	}
+	if ((h->version != CHECKPOINT_VERSION)||(h->layout != CHECKPOINT_LAYOUT)||(h->wordSize != sizeof(uintptr_t))||(h->pondDepth != POND_DEPTH)) {
+		fprintf(stderr,"*** Checkpoint %s was written by an incompatible build ***\n",path);
+		exit(1);
+	}
+#ifdef USE_TILED_SCHEDULER
+	if (h->generators != TILE_COUNT) {
+		fprintf(stderr,"*** Checkpoint %s was written by an incompatible build ***\n",path);
+		exit(1);
+	}
+#endif
+#ifdef FIXED_POND_SIZE
+	if ((h->sizeX != pondSizeX)||(h->sizeY != pondSizeY)) {
+		fprintf(stderr,"*** Checkpoint %s is for a %llux%llu pond ***\n",path,(unsigned long long)h->sizeX,(unsigned long long)h->sizeY);
+		exit(1);
+	}
+#else
+	pondSizeX = (uintptr_t)h->sizeX;
+	pondSizeY = (uintptr_t)h->sizeY;
+#endif
+	return fd;
+}
+
+/**
+ * Restores the pond and generators from a checkpoint
+ *
+ * The pond must already be allocated. Generator state is read in and the
+ * pond blocks are mapped over pond memory.
+ *
+ * @param fd Descriptor from openCheckpoint()
+ * @param h Header from openCheckpoint()
+ */
+static void restoreCheckpoint(const int fd,const struct CheckpointHeader *const h)
+{
+	struct CheckpointBlock b[CHECKPOINT_MAX_BLOCKS];
+	struct stat st;
+	uintptr_t i,n;
+	uint64_t offset;
+	int ok;
+
+#ifdef USE_TILED_SCHEDULER
+	n = getCheckpointBlocks(b,h->generators);
+#else
+	/* Extra threads keep their fresh generators, and missing ones are
+	 * dropped */
+	n = getCheckpointBlocks(b,(h->generators < threadCount) ? h->generators : threadCount);
+#endif
+	/* Generator state is read in and the pond is mapped */
+	offset = nextCheckpointOffset(0,sizeof(struct CheckpointHeader));
+	ok = (pread(fd,b[0].ptr,b[0].size,(off_t)offset) == (ssize_t)b[0].size);
+#ifdef USE_TILED_SCHEDULER
+	offset = nextCheckpointOffset(offset,b[0].size);
+#else
+	offset = nextCheckpointOffset(offset,sizeof(struct PRNG) * h->generators);
+#endif
+	ok = ((ok)&&(fstat(fd,&st) == 0));
+	for(i=1;(ok)&&(i<n);++i) {
+		ok = (((uint64_t)st.st_size >= (offset + b[i].size))&&(mmap(b[i].ptr,b[i].size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_FIXED,fd,(off_t)offset) != MAP_FAILED));
+		offset = nextCheckpointOffset(offset,b[i].size);
+	}
+#ifdef USE_GENOME_STORE
+	ok = ((ok)&&((uint64_t)st.st_size >= (offset + (sizeof(uintptr_t) * POND_DEPTH_SYSWORDS * POND_SIZE)))&&(readCheckpointGenomes(fd,offset)));
+#endif
+	if (!ok) {
+		fprintf(stderr,"*** Unable to restore checkpoint (file truncated?) ***\n");
+		exit(1);
+	}
+	close(fd);
+
+	startClock = h->clock;
+	cellIdCounter = h->cellIdCounter;
+}
+
+/*
+ * Reporter thread
+ *
+ * Normally thread 0 reports every reportFrequency ticks. With a report
+ * interval (-w) a separate thread reports every so many milliseconds of
+ * wall clock time instead, and thread 0 only does census, checkpoint and
+ * display work. The reporter starts a new snapshot epoch and each thread
+ * copies its counters into its StatSnapshot at its next statPoint()
+ * between cells, so the counters reported are a consistent set from
+ * every thread.
+ *
+ * The pond totals (energy, active cells, viable replicators and max
+ * generation) are another matter. Without USE_INCREMENTAL_STATS they
+ * come from a scan of the pond that the reporter runs while the other
+ * threads keep changing it, with no pause and no snapshot. They are
+ * then only approximate: cells change under the scan, so a SHARE can be
+ * counted on one side but not the other, and the totals don't add up to
+ * any moment of the pond. The scan also takes as much memory bandwidth
+ * as it does on thread 0, just from another core. With
+ * USE_INCREMENTAL_STATS the totals are made from the snapshotted
+ * per-thread deltas instead, so they are as consistent as the counters
+ * and there is no scan.
+ */
+
+struct CACHE_ALIGNED StatSnapshot
+{
+	/* Epoch this snapshot was taken in, or SNAPSHOT_FINAL if the thread
+	 * has finished and this is its last one */
+	uint64_t epoch;
+
+	/* Ticks the thread has run since it started */
+	uint64_t ticks;
+
+	struct StatCounters stats;
+};
+
+#define SNAPSHOT_FINAL (~((uint64_t)0))
+
+/* Milliseconds between reports from the reporter thread, or 0 if thread
+ * 0 reports every reportFrequency ticks */
+static uintptr_t reportInterval = 0;
+
+static struct StatSnapshot *statSnapshots;
+static uint64_t snapshotEpoch = 0;
+
+/* Called by each thread between cells */
+static inline void statPoint(const uintptr_t threadNo,const uint64_t ticks)
+{
+	struct StatSnapshot *const ss = &statSnapshots[threadNo];
+	const uint64_t epoch = __atomic_load_n(&snapshotEpoch,__ATOMIC_ACQUIRE);
+	if (epoch != ss->epoch) {
+		ss->ticks = ticks;
+		ss->stats = statCounters[threadNo];
+		__atomic_store_n(&ss->epoch,epoch,__ATOMIC_RELEASE);
+	}
+}
+
+/* Called by each thread when it finishes */
+static void statFinal(const uintptr_t threadNo,const uint64_t ticks)
+{
+	struct StatSnapshot *const ss = &statSnapshots[threadNo];
+	ss->ticks = ticks;
+	ss->stats = statCounters[threadNo];
+	__atomic_store_n(&ss->epoch,SNAPSHOT_FINAL,__ATOMIC_RELEASE);
+}
+
+/* Reports from thread 0 if there's no reporter thread */
+static void reportTicks(const uint64_t clock)
+{
+	struct StatCounters totals;
+	if (!reportInterval) {
+		sumStatCounters(&totals);
+		doReport(clock,&totals);
+	}
+}
+
+#ifdef USE_PTHREADS_COUNT
+static void *reporter(void *arg)
+{
+	struct StatCounters totals;
+	struct timespec ts;
+	uint64_t epoch,ticks,e;
+	uintptr_t t,spins;
+	double next = getSeconds(),wait;
+	(void)arg;
+
+	while (!exitNow) {
+		/* Sleep in short naps so exiting isn't held up */
+		next += (double)reportInterval / 1000.0;
+		while ((!exitNow)&&((wait = next - getSeconds()) > 0.0)) {
+			if (wait > 0.05)
+				wait = 0.05;
+			ts.tv_sec = 0;
+			ts.tv_nsec = (long)(wait * 1000000000.0);
+			nanosleep(&ts,(struct timespec *)0);
+		}
+		if (exitNow)
+			break;
+
+		epoch = __atomic_add_fetch(&snapshotEpoch,1,__ATOMIC_ACQ_REL);
+		memset(&totals,0,sizeof(totals));
+		ticks = 0;
+		for(t=0;t<threadCount;++t) {
+			spins = 0;
+			while (((e = __atomic_load_n(&statSnapshots[t].epoch,__ATOMIC_ACQUIRE)) != epoch)&&(e != SNAPSHOT_FINAL)&&(!exitNow))
+				spinBackoff(&spins);
+			addStatCounters(&totals,&statSnapshots[t].stats);
+			ticks += statSnapshots[t].ticks;
+		}
+		if (exitNow)
+			break;
+
+#ifdef USE_TILED_SCHEDULER
+		doReport((startClock + ticks) / threadCount,&totals);
+#else
+		doReport(startClock + (ticks / threadCount),&totals);
+#endif
+	}
+	return (void *)0;
+}
+#endif /* USE_PTHREADS_COUNT */
+
+#ifdef USE_CONTROL
+/*
+ * Control socket
+ *
+ * With -C a control thread listens on a Unix domain socket for up to
+ * CONTROL_CLIENTS clients at a time, which send commands one per line
+ * and get back a line starting with "ok" or "error":
+ *
+ *   stream          Follow with every report line as it's printed
+ *   image [w h]     "ok <bytes>", then a w by h binary PPM of the pond
+ *                   in the display colors (default the pond size)
+ *   dump <x> <y>    "ok <genome>" for the cell at x, y, as dumpCell()
+ *   checkpoint      Write a checkpoint to the -c file now
+ *   color           Switch to the next color scheme
+ *   stop            Stop as on SIGINT
+ *
+ * For example: echo stream | socat - UNIX-CONNECT:pond.sock
+ *
+ * Worker threads never wait on the control thread. Images and dumps are
+ * read from the running pond with snapshots like the SDL display uses
+ * (without cell locks a cell may be caught mid-update, which does no
+ * harm), and report lines come from publishReport(). Commands that need
+ * the pond at rest go on a lock-free queue for thread 0, which looks at
+ * it every report with the random scheduler and between phases with the
+ * tiled one.
+ *
+ * The control thread never waits on clients either. Replies are queued
+ * for each client and sent as its socket takes them, and a client is
+ * only read from again once it has taken all of the last reply. A
+ * client that takes nothing for CONTROL_STALL_SECONDS while a reply is
+ * pending is dropped. Streaming clients miss the report lines that come
+ * while a reply is still pending.
+ */
+
+#define CONTROL_CLIENTS 8
+
+/* Seconds a client may leave a reply unread before it's dropped */
+#define CONTROL_STALL_SECONDS 10
+
+/* Commands are queued for thread 0 in a ring the control thread puts to
+ * and thread 0 takes from; its size must be a power of two */
+#define CONTROL_QUEUE_SIZE 16
+
+enum { CONTROL_CHECKPOINT,CONTROL_COLOR };
+
+static uint8_t controlQueue[CONTROL_QUEUE_SIZE];
+static uintptr_t controlHead = 0;
+static uintptr_t controlTail = 0;
+
+/* Socket path given with -C, or null for none */
+static const char *controlPath = (const char *)0;
+static int controlFd = -1;
+
+struct ControlClient
+{
+	/* Socket, or -1 if this slot is free */
+	int fd;
+
+	/* Nonzero if report lines are sent to this client */
+	int streaming;
+
+	/* Command line read so far, not yet ended by a newline */
+	uintptr_t inLength;
+	char in[256];
+
+	/* Replies queued to send: out[outSent] up to out[outLength] is still
+	 * to go, and outSeconds is when the client last took any */
+	uint8_t *out;
+	uintptr_t outCapacity;
+	uintptr_t outLength;
+	uintptr_t outSent;
+	double outSeconds;
+};
+
+/* Queues a command for thread 0, returning 0 if the queue is full */
+static int putControl(const uint8_t cmd)
+{
+	const uintptr_t tail = __atomic_load_n(&controlTail,__ATOMIC_RELAXED);
+	if ((tail - __atomic_load_n(&controlHead,__ATOMIC_ACQUIRE)) >= CONTROL_QUEUE_SIZE)
+		return 0;
+	controlQueue[tail & (CONTROL_QUEUE_SIZE - 1)] = cmd;
+	__atomic_store_n(&controlTail,tail + 1,__ATOMIC_RELEASE);
+	return 1;
+}
+
+/* Cheap enough for thread 0 to call whenever it could run commands */
+static inline int controlPending()
+{
+	return (__atomic_load_n(&controlTail,__ATOMIC_RELAXED) != __atomic_load_n(&controlHead,__ATOMIC_RELAXED));
+}
+
+/**
+ * Runs the commands queued for thread 0
+ *
+ * @param clock Clock to checkpoint at, as for startCheckpoint()
+ */
+static void runControl(const uint64_t clock)
+{
+	const uintptr_t tail = __atomic_load_n(&controlTail,__ATOMIC_ACQUIRE);
+	uintptr_t head;
+	for(head=__atomic_load_n(&controlHead,__ATOMIC_RELAXED);head!=tail;++head) {
+		switch(controlQueue[head & (CONTROL_QUEUE_SIZE - 1)]) {
+			case CONTROL_CHECKPOINT:
+				fprintf(stderr,"[CONTROL] Checkpoint requested at clock %llu\n",(unsigned long long)clock);
+				startCheckpoint(clock);
+				break;
+			case CONTROL_COLOR:
+				colorScheme = (colorScheme + 1) % MAX_COLOR_SCHEME;
+				fprintf(stderr,"[CONTROL] Switching to color scheme \"%s\".\n",colorSchemeName[colorScheme]);
+#ifdef USE_SDL
+				markAllDirty();
+#endif
+				break;
+		}
+	}
+	__atomic_store_n(&controlHead,tail,__ATOMIC_RELEASE);
+}
+
+/* Sends as much of a client's queued replies as its socket will take
+ * without waiting, returning 0 if it went away */
+static int controlFlush(struct ControlClient *const cl)
+{
+	ssize_t w;
+	while (cl->outSent < cl->outLength) {
+		if ((w = send(cl->fd,cl->out + cl->outSent,cl->outLength - cl->outSent,MSG_DONTWAIT|MSG_NOSIGNAL)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return ((errno == EAGAIN)||(errno == EWOULDBLOCK));
+		}
+		cl->outSent += (uintptr_t)w;
+		cl->outSeconds = getSeconds();
+	}
+	cl->outLength = cl->outSent = 0;
+	return 1;
+}
+
+/* Nonzero if a client hasn't taken all of its replies yet */
+#define controlBusy(cl) ((cl)->outLength != 0)
+
+/* Makes room for n more bytes of reply to a client, returning where */
+static uint8_t *controlReserve(struct ControlClient *const cl,const uintptr_t n)
+{
+	uint8_t *p;
+	if (!controlBusy(cl))
+		cl->outSeconds = getSeconds();
+	cl->out = (uint8_t *)growArray(cl->out,&cl->outCapacity,cl->outLength + n,1);
+	p = cl->out + cl->outLength;
+	cl->outLength += n;
+	return p;
+}
+
+/* Queues a buffer for a client and starts sending it, returning 0 if
+ * the client went away */
+static int controlWrite(struct ControlClient *const cl,const void *const buf,const uintptr_t n)
+{
+	memcpy(controlReserve(cl,n),buf,n);
+	return controlFlush(cl);
+}
+
+#define controlReply(cl,s) controlWrite((cl),(s),sizeof(s) - 1)
+
+/**
+ * Sends a client a downsampled image of the pond
+ *
+ * Each pixel is the cell nearest its corner, in the default SDL 1.2.15
+ * palette the display uses (3 bits of red and green, 2 of blue).
+ *
+ * @param cl Client
+ * @param w Image width, at most pondSizeX
+ * @param h Image height, at most pondSizeY
+ * @return 0 if the client went away
+ */
+static int sendImage(struct ControlClient *const cl,const uintptr_t w,const uintptr_t h)
+{
+	char head[128];
+	const int headLength = snprintf(head,sizeof(head),"P6\n%u %u\n255\n",(unsigned int)w,(unsigned int)h);
+	const uintptr_t n = (uintptr_t)headLength + (w * h * 3);
+	uint8_t *p;
+	uintptr_t x,y;
+	uint8_t c;
+	char ok[64];
+	const int okLength = snprintf(ok,sizeof(ok),"ok %llu\n",(unsigned long long)n);
+
+	p = controlReserve(cl,(uintptr_t)okLength + n);
+	memcpy(p,ok,(size_t)okLength);
+	memcpy(p + okLength,head,(size_t)headLength);
+	p += okLength + headLength;
+	for(y=0;y<h;++y) {
+		for(x=0;x<w;++x) {
+			c = getColor(CELL_INDEX((x * pondSizeX) / w,(y * pondSizeY) / h));
+			*(p++) = (uint8_t)(((((c >> 5) & 7) * 255) + 3) / 7);
+			*(p++) = (uint8_t)(((((c >> 2) & 7) * 255) + 3) / 7);
+			*(p++) = (uint8_t)((c & 3) * 85);
+		}
+	}
+	return controlFlush(cl);
+}
+
+/* Sends a client the genome of a cell */
+static int sendCell(struct ControlClient *const cl,const uintptr_t cell)
+{
+	char *buf = (char *)0;
+	size_t n = 0;
+	int r;
+	FILE *const f = open_memstream(&buf,&n);
+	if (!f)
+		return controlReply(cl,"error out of memory\n");
+	fputs("ok ",f);
+	dumpCell(f,cell);
+	if (fclose(f) != 0) {
+		free(buf);
+		return controlReply(cl,"error out of memory\n");
+	}
+	r = controlWrite(cl,buf,(uintptr_t)n);
+	free(buf);
+	return r;
+}
+
+/* Parses a decimal number up to max after a command, advancing *s */
+static int controlNumber(char **const s,const uintptr_t max,uintptr_t *const v)
+{
+	char *end = (char *)0;
+	const unsigned long long n = strtoull(*s,&end,10);
+	if ((end == *s)||(n > max))
+		return 0;
+	*s = end;
+	*v = (uintptr_t)n;
+	return 1;
+}
+
+/**
+ * Runs a command from a client
+ *
+ * @param cl Client
+ * @param cmd Command line, without its newline
+ * @return 0 if the client went away
+ */
+static int controlCommand(struct ControlClient *const cl,char *cmd)
+{
+	uintptr_t x,y;
+
+	while (*cmd == ' ')
+		++cmd;
+	if (!strcmp(cmd,"stream")) {
+		cl->streaming = 1;
+		return controlReply(cl,"ok\n");
+	} else if (!strncmp(cmd,"image",5)) {
+		cmd += 5;
+		x = pondSizeX;
+		y = pondSizeY;
+		while (*cmd == ' ')
+			++cmd;
+		if ((*cmd)&&((!controlNumber(&cmd,pondSizeX,&x))||(!controlNumber(&cmd,pondSizeY,&y))||(!x)||(!y)||(*cmd)))
+			return controlReply(cl,"error usage: image [w h]\n");
+		return sendImage(cl,x,y);
+	} else if (!strncmp(cmd,"dump",4)) {
+		cmd += 4;
+		if ((!controlNumber(&cmd,pondSizeX - 1,&x))||(!controlNumber(&cmd,pondSizeY - 1,&y))||(*cmd))
+			return controlReply(cl,"error usage: dump x y\n");
+		return sendCell(cl,CELL_INDEX(x,y));
+	} else if (!strcmp(cmd,"checkpoint")) {
+		if (!checkpointFile)
+			return controlReply(cl,"error no checkpoint file (-c)\n");
+		return putControl(CONTROL_CHECKPOINT) ? controlReply(cl,"ok\n") : controlReply(cl,"error busy\n");
+	} else if (!strcmp(cmd,"color")) {
+		return putControl(CONTROL_COLOR) ? controlReply(cl,"ok\n") : controlReply(cl,"error busy\n");
+	} else if (!strcmp(cmd,"stop")) {
+		fprintf(stderr,"[CONTROL] Stop requested\n");
+		exitNow = 1;
+		return controlReply(cl,"ok\n");
+	}
+	return controlReply(cl,"error unknown command\n");
+}
+
+/* Reads what a client has sent and runs any complete commands */
+static int controlRead(struct ControlClient *const cl)
+{
+	char *line,*nl;
+	const ssize_t r = read(cl->fd,cl->in + cl->inLength,sizeof(cl->in) - 1 - cl->inLength);
+	if (r <= 0)
+		return ((r < 0)&&((errno == EINTR)||(errno == EAGAIN)||(errno == EWOULDBLOCK)));
+	cl->inLength += (uintptr_t)r;
+	cl->in[cl->inLength] = (char)0;
+	line = cl->in;
+	while ((nl = strchr(line,'\n'))) {
+		*nl = (char)0;
+		if ((nl > line)&&(nl[-1] == '\r'))
+			nl[-1] = (char)0;
+		if (!controlCommand(cl,line))
+			return 0;
+		line = nl + 1;
+	}
+	cl->inLength -= (uintptr_t)(line - cl->in);
+	memmove(cl->in,line,cl->inLength);
+	if (cl->inLength >= (sizeof(cl->in) - 1)) {
+		cl->inLength = 0;
+		return controlReply(cl,"error command too long\n");
+	}
+	return 1;
+}
+
+/* Closes a client's socket and frees its slot */
+static void closeClient(struct ControlClient *const cl)
+{
+	close(cl->fd);
+	cl->fd = -1;
+	cl->outLength = cl->outSent = 0;
+}
+
+/**
+ * Sends the report lines published since the last call to streaming
+ * clients
+ *
+ * @param clients Clients
+ * @param sent Report lines already sent (or skipped)
+ */
+static void streamReports(struct ControlClient *const clients,uint64_t *const sent)
+{
+	char line[REPORT_LINE_SIZE];
+	uintptr_t n,i;
+	const uint64_t count = __atomic_load_n(&reportLineCount,__ATOMIC_ACQUIRE);
+
+	if ((count - *sent) > REPORT_LINES)
+		*sent = count - REPORT_LINES;
+	for(;*sent<count;++*sent) {
+		n = reportLineLengths[*sent % REPORT_LINES];
+		if (n > REPORT_LINE_SIZE)
+			n = REPORT_LINE_SIZE;
+		memcpy(line,reportLines[*sent % REPORT_LINES],n);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if ((__atomic_load_n(&reportLineCount,__ATOMIC_RELAXED) - *sent) >= REPORT_LINES)
+			continue; /* Overwritten while we were copying it */
+		for(i=0;i<CONTROL_CLIENTS;++i) {
+			if ((clients[i].fd >= 0)&&(clients[i].streaming)&&(!controlBusy(&clients[i]))&&(!controlWrite(&clients[i],line,n)))
+				closeClient(&clients[i]);
+		}
+	}
+}
+
+/* Opens the control socket, exiting if it can't */
+static void openControl()
+{
+	struct sockaddr_un addr;
+	struct stat st;
+
+	if (strlen(controlPath) >= sizeof(addr.sun_path)) {
+		fprintf(stderr,"*** Control socket path %s is too long ***\n",controlPath);
+		exit(1);
+	}
+	memset(&addr,0,sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path,controlPath);
+
+	/* A socket left behind by an earlier run is replaced */
+	if ((lstat(controlPath,&st) == 0)&&(S_ISSOCK(st.st_mode)))
+		unlink(controlPath);
+	if (((controlFd = socket(AF_UNIX,SOCK_STREAM,0)) < 0)||(bind(controlFd,(struct sockaddr *)&addr,sizeof(addr)) < 0)||(listen(controlFd,CONTROL_CLIENTS) < 0)) {
+		fprintf(stderr,"*** Unable to listen on control socket %s ***\n",controlPath);
+		exit(1);
+	}
+	fprintf(stderr,"[CONTROL] Listening on %s\n",controlPath);
+}
+
+static void *controller(void *arg)
+{
+	struct ControlClient clients[CONTROL_CLIENTS];
+	struct pollfd fds[CONTROL_CLIENTS + 1];
+	uint64_t sent = __atomic_load_n(&reportLineCount,__ATOMIC_ACQUIRE);
+	uintptr_t i;
+	int fd;
+	(void)arg;
+
+	for(i=0;i<CONTROL_CLIENTS;++i) {
+		clients[i].fd = -1;
+		clients[i].out = (uint8_t *)0;
+		clients[i].outCapacity = 0;
+		clients[i].outLength = clients[i].outSent = 0;
+	}
+	fds[0].fd = controlFd;
+	fds[0].events = POLLIN;
+
+	while (!exitNow) {
+		/* Wake up often enough to stream reports and not hold up exiting */
+		for(i=0;i<CONTROL_CLIENTS;++i) {
+			fds[i + 1].fd = clients[i].fd;
+			fds[i + 1].events = controlBusy(&clients[i]) ? POLLOUT : POLLIN;
+			fds[i + 1].revents = 0;
+		}
+		fds[0].revents = 0;
+		poll(fds,CONTROL_CLIENTS + 1,50);
+
+		if (fds[0].revents & POLLIN) {
+			if ((fd = accept(controlFd,(struct sockaddr *)0,(socklen_t *)0)) >= 0) {
+				for(i=0;(i<CONTROL_CLIENTS)&&(clients[i].fd >= 0);++i);
+				if (i < CONTROL_CLIENTS) {
+					fcntl(fd,F_SETFL,fcntl(fd,F_GETFL) | O_NONBLOCK);
+					clients[i].fd = fd;
+					clients[i].streaming = 0;
+					clients[i].inLength = 0;
+				} else {
+					send(fd,"error too many clients\n",23,MSG_DONTWAIT|MSG_NOSIGNAL);
+					close(fd);
+				}
+			}
+		}
+		for(i=0;i<CONTROL_CLIENTS;++i) {
+			if ((fds[i + 1].fd < 0)||(clients[i].fd < 0))
+				continue;
+			if (controlBusy(&clients[i])) {
+				if (!controlFlush(&clients[i]))
+					closeClient(&clients[i]);
+				else if ((controlBusy(&clients[i]))&&((getSeconds() - clients[i].outSeconds) >= CONTROL_STALL_SECONDS)) {
+					fprintf(stderr,"[CONTROL] Dropping a client that stopped reading\n");
+					closeClient(&clients[i]);
+				}
+			} else if ((fds[i + 1].revents)&&(!controlRead(&clients[i])))
+				closeClient(&clients[i]);
+		}
+
+		streamReports(clients,&sent);
+	}
+
+	for(i=0;i<CONTROL_CLIENTS;++i) {
+		if (clients[i].fd >= 0)
+			close(clients[i].fd);
+		free(clients[i].out);
+	}
+	return (void *)0;
+}
+#endif /* USE_CONTROL */
+
+#ifndef USE_TILED_SCHEDULER
+
+/* Picks a cell uniformly at random from the whole pond */
+static inline void pickCell(struct PRNG *const prng,uintptr_t *const x,uintptr_t *const y)
+{
+	const uintptr_t i = getRandom(prng);
+	*x = POND_MOD_X(i);
+	*y = POND_MOD_Y(POND_DIV_X(i) >> 1);
+}
+
+#ifdef CELL_PREFETCH_DEPTH
+/* Prefetches what running a cell will touch first: its lock, attributes
+ * and the start of its genome, and the attributes and logos of its
+ * neighbors, which access checks look at */
+static inline void prefetchCell(const uintptr_t x,const uintptr_t y)
+{
+	const uintptr_t c = CELL_INDEX(x,y);
+	uintptr_t d,n;
+#ifdef USE_CELL_LOCKS
+	__builtin_prefetch(CELL_LOCK(c),1);
+#endif
+	__builtin_prefetch(&CELL_ENERGY(c),1);
+	__builtin_prefetch(CELL_GENOME(c),1);
+	for(d=0;d<4;++d) {
+		n = getNeighbor(x,y,d);
+		__builtin_prefetch(&CELL_ENERGY(n),0);
+#ifdef USE_SOA_POND
+		__builtin_prefetch(&pondLogo[n],0);
+#else
+		__builtin_prefetch(CELL_GENOME(n),0);
+#endif
+	}
+}
+#endif /* CELL_PREFETCH_DEPTH */
+
+/**
+ * Random scheduler: each thread picks cells to execute uniformly at
+ * random from the whole pond.
+ *
+ * @param threadNo Thread number, 0 being the main thread
+ */
+static void runRandom(const uintptr_t threadNo)
+{
+	struct ExecContext ctx;
+	uintptr_t x,y;
+	uintptr_t clock = startClock;
+#ifdef CELL_PREFETCH_DEPTH
+	uintptr_t aheadX[CELL_PREFETCH_DEPTH],aheadY[CELL_PREFETCH_DEPTH],ahead;
+#endif
+
+	ctx.prng = &prngState[threadNo];
+	ctx.stats = &statCounters[threadNo];
+	ctx.loops = &loopIndex[threadNo];
+#ifdef USE_BATCH_ENGINE
+	ctx.batch = &batches[threadNo];
+#endif
+	ctx.cellIdCounter = &cellIdCounter;
+	ctx.cellIdStep = 1;
+
+#ifdef CELL_PREFETCH_DEPTH
+	for(ahead=0;ahead<CELL_PREFETCH_DEPTH;++ahead) {
+		pickCell(ctx.prng,&aheadX[ahead],&aheadY[ahead]);
+		prefetchCell(aheadX[ahead],aheadY[ahead]);
+	}
+	ahead = 0;
+#endif
+
+	/* Main loop */
+	while (!exitNow) {
+		if ((runTicks)&&((clock - startClock) >= runTicks))
+			break;
+
+		/* Increment clock and run reports periodically */
+		/* Clock is incremented at the start, so it starts at 1 */
+		++clock;
+		if ((threadNo == 0)&&(!(clock % reportFrequency))) {
+			FLUSH_CELLS(&ctx);
+			reportTicks(clock);
+			takeCensus(clock);
+			/* SDL display is also refreshed every REPORT_FREQUENCY */
+#ifdef USE_SDL
+			refreshDisplay();
+#endif /* USE_SDL */
+#ifdef USE_CONTROL
+			if (controlPending())
+				runControl(clock);
+#endif
+		}
+
+		/* Introduce a random cell somewhere with a given energy level
+		 * every INFLOW_FREQUENCY clock ticks. */
+		if (!(clock % inflowFrequency)) {
+			x = POND_MOD_X(getRandom(ctx.prng));
+			y = POND_MOD_Y(getRandom(ctx.prng));
+			SEED_CELL(&ctx,x,y);
+		}
+
+		/* Pick a random cell to execute */
+#ifdef CELL_PREFETCH_DEPTH
+		x = aheadX[ahead];
+		y = aheadY[ahead];
+		pickCell(ctx.prng,&aheadX[ahead],&aheadY[ahead]);
+		prefetchCell(aheadX[ahead],aheadY[ahead]);
+		ahead = (ahead + 1) % CELL_PREFETCH_DEPTH;
+#else
+		pickCell(ctx.prng,&x,&y);
+#endif
+		RUN_CELL(&ctx,x,y);
+
+		statPoint(threadNo,clock - startClock);
+		if (threadNo == 0) {
+			if ((checkpointFile)&&(checkpointFrequency)&&(!(clock % checkpointFrequency))) {
+				FLUSH_CELLS(&ctx);
+				startCheckpoint(clock);
+			}
+		} else if (pausePending()) {
+			FLUSH_CELLS(&ctx);
+			pausePoint();
+		}
+	}
+	FLUSH_CELLS(&ctx);
+
+	statFinal(threadNo,clock - startClock);
+	if (threadNo == 0)
+		stopClock = clock;
+	else parkThread();
+}
+
+#else /* USE_TILED_SCHEDULER */
+
+/*
+ * Tiled scheduler
+ *
+ * The pond is cut into TILES_X by TILES_Y tiles. Tiles are colored like
+ * a checkerboard with four colors by the parity of their X and Y tile
+ * coordinates, and execution proceeds in phases that each run every tile
+ * of one color. Since tile counts are even and tiles are at least two
+ * cells across, no two tiles running in the same phase are adjacent and
+ * the cells they can reach (their own plus the facing edge of
+ * neighboring tiles) never overlap. Cross-tile SHARE, KILL and offspring
+ * writes therefore always land in tiles nobody is running, needing no
+ * locks, and are visible to their owners after the phase boundary.
+ *
+ * Each tile has its own random number generator and cell ID sequence,
+ * so results only depend on the seed and not on which thread happens to
+ * run which tile. Reports are made between phases while the pond is at
+ * rest, which makes runs bit-for-bit reproducible.
+ */
+
+/* Tiles run in a phase are picked by block: 2x2 blocks of tiles are
+ * numbered down columns, and each phase runs one tile of every block. */
+#define TILE_BLOCKS (TILE_COUNT / 4)
+#define BLOCK_TILE_X(k,phase) ((((k) / (TILES_Y / 2)) * 2) + ((phase) & 1))
+#define BLOCK_TILE_Y(k,phase) ((((k) % (TILES_Y / 2)) * 2) + ((phase) >> 1))
+
+#ifdef USE_NUMA
+/* Each thread is at home on an even share of the blocks, which being
+ * numbered down columns is a strip of the pond that's contiguous in
+ * memory. Threads first take the tiles of their own blocks in each phase
+ * and then any left over, so tiles mostly run on the node their memory
+ * is on and threads still never wait while there's work. */
+#define BLOCK_HOME(k) (((k) * threadCount) / TILE_BLOCKS)
+#define FIRST_HOME_BLOCK(t) ((((t) * TILE_BLOCKS) + threadCount - 1) / threadCount)
+
+/* Set for blocks whose tile has been taken in the current phase */
+static uint8_t blockTaken[TILE_BLOCKS];
+#else
+/* Next block to hand out in the current phase */
+static uintptr_t tileCursor = 0;
+#endif
+
+/**
+ * Takes a block whose tile this thread is to run in the current phase
+ *
+ * @param threadNo Thread number
+ * @param next Blocks this thread has looked at this phase, reset to 0 each phase
+ * @param k Block taken
+ * @return Nonzero if a block was taken, 0 if there are none left
+ */
+static inline int nextTile(const uintptr_t threadNo,uintptr_t *const next,uintptr_t *const k)
+{
+#ifdef USE_NUMA
+	while (*next < TILE_BLOCKS) {
+		*k = (FIRST_HOME_BLOCK(threadNo) + (*next)++) % TILE_BLOCKS;
+		if ((!__atomic_load_n(&blockTaken[*k],__ATOMIC_RELAXED))&&(!__atomic_exchange_n(&blockTaken[*k],1,__ATOMIC_RELAXED)))
+			return 1;
+	}
+	return 0;
+#else
+	(void)threadNo;
+	(void)next;
+	return ((*k = __atomic_fetch_add(&tileCursor,1,__ATOMIC_RELAXED)) < TILE_BLOCKS);
+#endif
+}
+
+/* Set by thread 0 between phases when all threads are to stop, so they
+ * agree on which phase is the last even if exitNow changes meanwhile */
+static int stopTiles = 0;
+
+static void initTiles()
+{
+	uintptr_t t;
+	for(t=0;t<TILE_COUNT;++t) {
+#ifdef USE_MPI
+		/* Every rank's tiles get their own streams and IDs */
+		seedRandom(&tiles[t].prng,prngSeed,((uintptr_t)mpiRank * TILE_COUNT) + t);
+		tiles[t].cellIdCounter = ((uint64_t)mpiRank * TILE_COUNT) + t;
+#else
+		seedRandom(&tiles[t].prng,prngSeed,t);
+		tiles[t].cellIdCounter = t;
+#endif
+		tiles[t].clock = 0;
+	}
+}
+
+#ifdef USE_PTHREADS_COUNT
+static uintptr_t barrierCount = 0;
+static uintptr_t barrierGeneration = 0;
+
+/* Waits until all threads have reached this point */
+static void tileBarrier()
+{
+	const uintptr_t generation = __atomic_load_n(&barrierGeneration,__ATOMIC_ACQUIRE);
+	uintptr_t spins = 0;
+	if (__atomic_add_fetch(&barrierCount,1,__ATOMIC_ACQ_REL) == threadCount) {
+		__atomic_store_n(&barrierCount,0,__ATOMIC_RELAXED);
+		__atomic_store_n(&barrierGeneration,generation + 1,__ATOMIC_RELEASE);
+	} else {
+		while (__atomic_load_n(&barrierGeneration,__ATOMIC_ACQUIRE) == generation)
+			spinBackoff(&spins);
+	}
+}
+#else
+#define tileBarrier() ((void)0)
+#endif /* USE_PTHREADS_COUNT */
+
+/**
+ * Runs one tile for TILE_PHASE_TICKS ticks
+ *
+ * Each tick introduces a random cell every INFLOW_FREQUENCY ticks and
+ * executes a random cell of the tile, just like the random scheduler
+ * does for the whole pond.
+ */
+static void runTile(struct ExecContext *const ctx,const uintptr_t tx,const uintptr_t ty)
+{
+	struct Tile *const t = &tiles[(ty * TILES_X) + tx];
+	const uintptr_t x0 = POND_OWNED_X0 + ((tx * POND_OWNED_SIZE_X) / TILES_X);
+	const uintptr_t y0 = (ty * pondSizeY) / TILES_Y;
+	const uintptr_t w = (POND_OWNED_X0 + (((tx + 1) * POND_OWNED_SIZE_X) / TILES_X)) - x0;
+	const uintptr_t h = (((ty + 1) * pondSizeY) / TILES_Y) - y0;
+	uintptr_t tick,x,y,i;
+
+	ctx->prng = &t->prng;
+	ctx->cellIdCounter = &t->cellIdCounter;
+
+	for(tick=0;tick<TILE_PHASE_TICKS;++tick) {
+		if (!(++t->clock % inflowFrequency)) {
+			x = x0 + (getRandom(ctx->prng) % w);
+			y = y0 + (getRandom(ctx->prng) % h);
+			SEED_CELL(ctx,x,y);
+		}
+		i = getRandom(ctx->prng);
+		x = x0 + (i % w);
+		y = y0 + (((i / w) >> 1) % h);
+		RUN_CELL(ctx,x,y);
+	}
+	FLUSH_CELLS(ctx);
+}
+
+#ifdef USE_GPU_ENGINE
+/*
+ * GPU engine
+ *
+ * A phase's tiles never reach each other's cells (see the tiled
+ * scheduler), so a phase is one kernel with a device thread per tile
+ * block running that block's tile, just as a host thread would. Writes
+ * to neighboring tiles land in tiles that aren't running, so they need
+ * no second pass: the end of the kernel is where they become visible.
+ * Every block has its own counters and loop index on the device, and
+ * the host only copies back the counters for reports; with the tiles'
+ * generators and ID counters on the device too, results are the same as
+ * running the tiled scheduler on the host.
+ */
+static struct StatCounters *blockStats;
+static struct LoopIndex *blockLoops;
+
+/* Maps everything cells run with to the device */
+static void gpuEnter()
+{
+	blockStats = (struct StatCounters *)allocPondMemory(sizeof(struct StatCounters) * TILE_BLOCKS);
+	blockLoops = (struct LoopIndex *)allocPondMemory(sizeof(struct LoopIndex) * TILE_BLOCKS);
+#pragma omp target enter data map(to:blockStats[0:TILE_BLOCKS],blockLoops[0:TILE_BLOCKS])
+#pragma omp target update to(tiles)
+	gpuEnterPond();
+	fprintf(stderr,"[GPU] Running on %s\n",(omp_get_num_devices() > 0) ? "an offload device" : "the host (no offload device)");
+}
+
+/* Runs one phase on the device */
+static void gpuRunPhase(const uintptr_t phase)
+{
+	struct StatCounters *const stats = blockStats;
+	struct LoopIndex *const loops = blockLoops;
+	uintptr_t k;
+#pragma omp target teams distribute parallel for map(tofrom:stats[0:TILE_BLOCKS],loops[0:TILE_BLOCKS])
+	for(k=0;k<TILE_BLOCKS;++k) {
+		struct ExecContext ctx;
+		ctx.stats = &stats[k];
+		ctx.loops = &loops[k];
+		ctx.cellIdStep = TILE_COUNT;
+		runTile(&ctx,BLOCK_TILE_X(k,phase),BLOCK_TILE_Y(k,phase));
+	}
+}
+
+/* Brings the device's counters back into the host thread's */
+static void gpuCopyStatsBack()
+{
+	uintptr_t k;
+#pragma omp target update from(blockStats[0:TILE_BLOCKS])
+	memset(&statCounters[0],0,sizeof(struct StatCounters));
+	for(k=0;k<TILE_BLOCKS;++k)
+		addStatCounters(&statCounters[0],&blockStats[k]);
+}
+
+/* Brings everything back from the device, e.g. for a checkpoint */
+static void gpuCopyBack()
+{
+	gpuCopyStatsBack();
+	gpuCopyPondBack();
+#pragma omp target update from(tiles)
+}
+#endif /* USE_GPU_ENGINE */
+
+#ifdef USE_MPI
+/*
+ * Distributed pond
+ *
+ * With MPI the pond is cut into vertical strips, one per rank, and each
+ * rank runs its strip with the tiled scheduler. A rank's pond has a
+ * ghost column on each side (X 0 and pondSizeX-1) holding a copy of the
+ * facing edge column of the neighboring strip, so cells on the edge run
+ * exactly as they would next to any other tile. The leftmost and
+ * rightmost tiles of a strip have different colors, and all ranks run
+ * the same phases in step, so while a rank's edge tiles may be writing
+ * to a ghost its owner's facing edge tiles aren't running.
+ *
+ * After every phase each rank sends each neighbor one message: which of
+ * that side's ghosts it wrote to (see markDirty()) and those ghosts, then
+ * its own edge column. The receiver applies the written ghosts to its
+ * edge and refreshes its ghosts from the sender's edge, except any it
+ * wrote itself and sent the other way. Ghosts then match their owners
+ * again for the next phase.
+ */
+
+/* A cell as sent to another rank */
+struct HaloCell
+{
+	uint64_t ID;
+	uint64_t parentID;
+	uint64_t lineage;
+	uint64_t generation;
+	uint64_t energy;
+	uint64_t genomeHigh;
+	CACHE_ALIGNED uintptr_t genome[POND_DEPTH_SYSWORDS];
+};
+
+/* Buffers sent to and received from the left (0) and right (1) ranks,
+ * which are haloBytes each: a dirty byte per ghost cell padded to a
+ * cache line, the ghosts and then the edge */
+static uint8_t *haloRecv[2];
+static size_t haloBytes;
+#define HALO_GHOSTS(b) ((struct HaloCell *)((b) + ((pondSizeY + 63) & ~((uintptr_t)63))))
+
+static void initHalos()
+{
+	uintptr_t s;
+	haloBytes = ((pondSizeY + 63) & ~((uintptr_t)63)) + (sizeof(struct HaloCell) * pondSizeY * 2);
+	for(s=0;s<2;++s) {
+		haloDirty[s] = (uint8_t *)allocPondMemory(haloBytes);
+		haloRecv[s] = (uint8_t *)allocPondMemory(haloBytes);
+	}
+}
+
+static inline void packCell(struct HaloCell *const h,const uintptr_t c)
+{
+	h->ID = CELL_ID(c);
+	h->parentID = CELL_PARENT_ID(c);
+	h->lineage = CELL_LINEAGE(c);
+	h->generation = (uint64_t)CELL_GENERATION(c);
+	h->energy = (uint64_t)CELL_ENERGY(c);
+	h->genomeHigh = (uint64_t)CELL_GENOME_HIGH(c);
+	memcpy(h->genome,CELL_GENOME(c),sizeof(uintptr_t) * CELL_GENOME_HIGH(c));
+}
+
+static inline void unpackCell(const uintptr_t c,const struct HaloCell *const h)
+{
+	CELL_ID(c) = h->ID;
+	CELL_PARENT_ID(c) = h->parentID;
+	CELL_LINEAGE(c) = h->lineage;
+	CELL_GENERATION(c) = (uintptr_t)h->generation;
+	CELL_ENERGY(c) = (uintptr_t)h->energy;
+	CELL_MATERIALIZE(c);
+	CELL_SET_GENOME(c,h->genome,(uintptr_t)h->genomeHigh);
+	CELL_SYNC_LOGO(c);
+}
+
+/* Swaps edges with the neighboring ranks while the pond is at rest */
+static void exchangeHalos()
+{
+	const uintptr_t ghostX[2] = { 0,pondSizeX - 1 };
+	const uintptr_t edgeX[2] = { 1,pondSizeX - 2 };
+	MPI_Request requests[4];
+	struct HaloCell *h;
+	uintptr_t s,y;
+	int peer;
+
+	for(s=0;s<2;++s) {
+		h = HALO_GHOSTS(haloDirty[s]);
+		for(y=0;y<pondSizeY;++y) {
+			if (haloDirty[s][y])
+				packCell(&h[y],CELL_INDEX(ghostX[s],y));
+			packCell(&h[pondSizeY + y],CELL_INDEX(edgeX[s],y));
+		}
+
+		/* Messages are tagged with the side of the sender they went out
+		 * of, so with two ranks the two sides can't be mixed up */
+		peer = s ? ((mpiRank + 1) % mpiRanks) : ((mpiRank + mpiRanks - 1) % mpiRanks);
+		MPI_Irecv(haloRecv[s],(int)haloBytes,MPI_BYTE,peer,(int)(1 - s),MPI_COMM_WORLD,&requests[s]);
+		MPI_Isend(haloDirty[s],(int)haloBytes,MPI_BYTE,peer,(int)s,MPI_COMM_WORLD,&requests[2 + s]);
+	}
+	MPI_Waitall(4,requests,MPI_STATUSES_IGNORE);
+
+	for(s=0;s<2;++s) {
+		h = HALO_GHOSTS(haloRecv[s]);
+		for(y=0;y<pondSizeY;++y) {
+			if (haloRecv[s][y])
+				unpackCell(CELL_INDEX(edgeX[s],y),&h[y]);
+			if (!haloDirty[s][y])
+				unpackCell(CELL_INDEX(ghostX[s],y),&h[pondSizeY + y]);
+		}
+		memset(haloDirty[s],0,pondSizeY);
+	}
+}
+#endif /* USE_MPI */
+
+/**
+ * Tiled scheduler main loop for one thread
+ *
+ * @param threadNo Thread number, 0 being the main thread
+ */
+static void runTiled(const uintptr_t threadNo)
+{
+	static uint64_t totalTicks = 0;
+	struct ExecContext ctx;
+	uintptr_t phase,k,next;
+	uint64_t clock,ticks = 0;
+
+	ctx.stats = &statCounters[threadNo];
+	ctx.loops = &loopIndex[threadNo];
+#ifdef USE_BATCH_ENGINE
+	ctx.batch = &batches[threadNo];
+#endif
+#ifdef USE_MPI
+	ctx.cellIdStep = (uint64_t)TILE_COUNT * (uint64_t)mpiRanks;
+#else
+	ctx.cellIdStep = TILE_COUNT;
+#endif
+
+	/* Pick up where a restored checkpoint left off */
+	if (threadNo == 0)
+		totalTicks = startClock;
+#ifdef USE_GPU_ENGINE
+	gpuEnter();
+#endif
+
+	for(phase=(startClock/PHASE_TICKS)&3;;phase=(phase+1)&3) {
+#ifdef USE_GPU_ENGINE
+		/* The whole phase is one kernel, run by the only host thread */
+		(void)ctx;
+		(void)next;
+		(void)k;
+		gpuRunPhase(phase);
+		ticks += PHASE_TICKS;
+#else
+		/* Grab tiles of this phase's color until there are none left */
+		next = 0;
+		while (nextTile(threadNo,&next,&k)) {
+			runTile(&ctx,BLOCK_TILE_X(k,phase),BLOCK_TILE_Y(k,phase));
+			ticks += TILE_PHASE_TICKS;
+			statPoint(threadNo,ticks);
+		}
+#endif
+		statPoint(threadNo,ticks);
+
+		tileBarrier();
 
-static void *run(void *targ)
-{
-	const uintptr_t threadNo = (uintptr_t)targ;
-	uintptr_t x,y,i;
-	uintptr_t clock = 0;
+		/* Between phases nothing is running, and thread 0 does reports,
+		 * checkpoints and display updates. The clock counts ticks per
+		 * thread to match the random scheduler. */
+		if (threadNo == 0) {
+#ifdef USE_MPI
+			exchangeHalos();
+#endif
+			clock = totalTicks / threadCount;
+			totalTicks += PHASE_TICKS;
+			if ((checkpointFile)&&(checkpointFrequency)&&((totalTicks / threadCount) / checkpointFrequency != clock / checkpointFrequency)) {
+#ifdef USE_GPU_ENGINE
+				gpuCopyBack();
+#endif
+				startCheckpoint(totalTicks);
+			}
+			if ((totalTicks / threadCount) / reportFrequency != clock / reportFrequency) {
+				clock = totalTicks / threadCount;
+#ifdef USE_GPU_ENGINE
+				gpuCopyStatsBack();
+#endif
+				reportTicks(clock);
+				takeCensus(clock);
+#ifdef USE_SDL
+				refreshDisplay();
+#endif /* USE_SDL */
+			}
+#ifdef USE_CONTROL
+			if (controlPending())
+				runControl(totalTicks);
+#endif
+			if ((runTicks)&&(((totalTicks - startClock) / threadCount) >= runTicks))
+				exitNow = 1;
+#ifdef USE_MPI
+			{
+				/* A signal may only have reached some of the ranks */
+				int stop = exitNow;
+				MPI_Allreduce(&stop,&stopTiles,1,MPI_INT,MPI_MAX,MPI_COMM_WORLD);
+			}
+#else
+			stopTiles = exitNow;
+#endif
+#ifdef USE_NUMA
+			memset(blockTaken,0,sizeof(blockTaken));
+#else
+			__atomic_store_n(&tileCursor,0,__ATOMIC_RELAXED);
+#endif
+		}
 
-	/* Buffer used for execution output of candidate offspring */
-	uintptr_t outputBuf[POND_DEPTH_SYSWORDS];
+		tileBarrier();
 
-	/* Miscellaneous variables used in the loop */
-	uintptr_t currentWord,wordPtr,shiftPtr,inst,tmp;
-	struct Cell *pptr,*tmpptr;
-	
-	/* Virtual machine memory pointer register (which
-	 * exists in two parts... read the code below...) */
-	uintptr_t ptr_wordPtr;
-	uintptr_t ptr_shiftPtr;
-	
-	/* The main "register" */
-	uintptr_t reg;
-	
-	/* Which way is the cell facing? */
-	uintptr_t facing;
-	
-	/* Virtual machine loop/rep stack */
-	uintptr_t loopStack_wordPtr[POND_DEPTH];
-	uintptr_t loopStack_shiftPtr[POND_DEPTH];
-	uintptr_t loopStackPtr;
-	
-	/* If this is nonzero, we're skipping to matching REP */
-	/* It is incremented to track the depth of a nested set
-	 * of LOOP/REP pairs in false state. */
-	uintptr_t falseLoopDepth;
+		if (stopTiles)
+			break;
+	}
 
-#ifdef USE_SDL
-	SDL_Event sdlEvent;
-	const uintptr_t sdlPitch = screen->pitch;
+#ifdef USE_GPU_ENGINE
+	gpuCopyBack();
 #endif
+	statFinal(threadNo,ticks);
+	if (threadNo == 0)
+		stopClock = totalTicks;
+}
 
-	/* If this is nonzero, cell execution stops. This allows us
-	 * to avoid the ugly use of a goto to exit the loop. :) */
-	int stop;
+#endif /* USE_TILED_SCHEDULER */
 
-	/* Main loop */
-	while (!exitNow) {
-		/* Increment clock and run reports periodically */
-		/* Clock is incremented at the start, so it starts at 1 */
-		++clock;
-		if ((threadNo == 0)&&(!(clock % REPORT_FREQUENCY))) {
-			doReport(clock);
-			/* SDL display is also refreshed every REPORT_FREQUENCY */
-#ifdef USE_SDL
-			while (SDL_PollEvent(&sdlEvent)) {
-				if (sdlEvent.type == SDL_QUIT) {
-					fprintf(stderr,"[QUIT] Quit signal received!\n");
-					exitNow = 1;
-				} else if (sdlEvent.type == SDL_MOUSEBUTTONDOWN) {
-					switch (sdlEvent.button.button) {
-						case SDL_BUTTON_LEFT:
-							fprintf(stderr,"[INTERFACE] Genome of cell at (%d, %d):\n",sdlEvent.button.x, sdlEvent.button.y);
-							dumpCell(stderr, &pond[sdlEvent.button.x][sdlEvent.button.y]);
-							break;
-						case SDL_BUTTON_RIGHT:
-							colorScheme = (colorScheme + 1) % MAX_COLOR_SCHEME;
-							fprintf(stderr,"[INTERFACE] Switching to color scheme \"%s\".\n",colorSchemeName[colorScheme]);
-							for (y=0;y<POND_SIZE_Y;++y) {
-								for (x=0;x<POND_SIZE_X;++x)
-									((uint8_t *)screen->pixels)[x + (y * sdlPitch)] = getColor(&pond[x][y]);
-							}
-							break;
-					}
-				}
-			}
-			SDL_BlitSurface(screen, NULL, winsurf, NULL);
-			SDL_UpdateWindowSurface(window);
-#endif /* USE_SDL */
+/*
+ * Pond initialization
+ *
+ * The pond is allocated as zero pages, which are empty cells (see
+ * CELL_MATERIALIZE()), so a new pond starts without writing to it. What
+ * does need doing is split over threadCount threads: pointing every cell
+ * at the empty genome with the genome store, and with USE_NUMA touching
+ * each page first on the thread that will mostly run it, so Linux puts
+ * it on that thread's node. Those threads are pinned as they will be
+ * when running, and touch their home tiles with the tiled scheduler or
+ * an even strip of columns each otherwise.
+ */
+#if defined(USE_GENOME_STORE) || defined(USE_NUMA)
+
+/* Sets up the cells from column x0 up to x1 and row y0 up to y1 */
+static void initCells(const uintptr_t x0,const uintptr_t x1,const uintptr_t y0,const uintptr_t y1)
+{
+	uintptr_t x,y,c;
+	for(x=x0;x<x1;++x) {
+		for(y=y0;y<y1;++y) {
+			c = CELL_INDEX(x,y);
+#ifdef USE_GENOME_STORE
+			CELL_GENOME_REF(c) = emptyGenome;
+#endif
+#ifdef USE_NUMA
+			/* These are zero already, but writing places the pages */
+			CELL_ID(c) = 0;
+			CELL_PARENT_ID(c) = 0;
+			CELL_LINEAGE(c) = 0;
+			CELL_GENERATION(c) = 0;
+			CELL_ENERGY(c) = 0;
+			CELL_GENOME_HIGH(c) = 0;
+#ifndef USE_GENOME_STORE
+			CELL_GENOME(c)[0] = 0;
+#endif
+#ifdef USE_SOA_POND
+			pondLogo[c] = 0;
+#endif
+#if defined(USE_CELL_LOCKS) && !defined(CELL_LOCK_STRIPES)
+			cellLocks[c] = 0;
+#endif
+#endif /* USE_NUMA */
 		}
+	}
+}
 
-		/* Introduce a random cell somewhere with a given energy level */
-		/* This is called seeding, and introduces both energy and
-		 * entropy into the substrate. This happens every INFLOW_FREQUENCY
-		 * clock ticks. */
-		if (!(clock % INFLOW_FREQUENCY)) {
-			x = getRandom() % POND_SIZE_X;
-			y = getRandom() % POND_SIZE_Y;
-			pptr = &pond[x][y];
+#ifdef USE_PTHREADS_COUNT
+static void *initThread(void *targ)
+{
+	const uintptr_t threadNo = (uintptr_t)targ;
+#if defined(USE_NUMA) && defined(USE_TILED_SCHEDULER)
+	uintptr_t k;
+	pinThread(threadNo);
+	for(k=0;k<TILE_BLOCKS;++k) {
+		if (BLOCK_HOME(k) == threadNo)
+			initCells(POND_OWNED_X0 + ((BLOCK_TILE_X(k,0) * POND_OWNED_SIZE_X) / TILES_X),POND_OWNED_X0 + (((BLOCK_TILE_X(k,0) + 2) * POND_OWNED_SIZE_X) / TILES_X),(BLOCK_TILE_Y(k,0) * pondSizeY) / TILES_Y,((BLOCK_TILE_Y(k,0) + 2) * pondSizeY) / TILES_Y);
+	}
+#else
+#ifdef USE_NUMA
+	pinThread(threadNo);
+#endif
+	initCells((threadNo * pondSizeX) / threadCount,((threadNo + 1) * pondSizeX) / threadCount,0,pondSizeY);
+#endif
+	return (void *)0;
+}
+#endif /* USE_PTHREADS_COUNT */
 
+static void initPond()
+{
 #ifdef USE_PTHREADS_COUNT
-			pthread_mutex_lock(&(pptr->lock));
+	pthread_t *const threads = (pthread_t *)malloc(sizeof(pthread_t) * threadCount);
+	uintptr_t i;
+	for(i=0;i<threadCount;++i)
+		pthread_create(&threads[i],0,initThread,(void *)i);
+	for(i=0;i<threadCount;++i)
+		pthread_join(threads[i],(void **)0);
+	free(threads);
+#else
+	initCells(0,pondSizeX,0,pondSizeY);
 #endif
+}
 
-			pptr->ID = cellIdCounter;
-			pptr->parentID = 0;
-			pptr->lineage = cellIdCounter;
-			pptr->generation = 0;
-#ifdef INFLOW_RATE_VARIATION
-			pptr->energy += INFLOW_RATE_BASE + (getRandom() % INFLOW_RATE_VARIATION);
+#endif /* USE_GENOME_STORE || USE_NUMA */
+
+static void *run(void *targ)
+{
+#ifdef USE_NUMA
+	pinThread((uintptr_t)targ);
+#endif
+#ifdef USE_TILED_SCHEDULER
+	runTiled((uintptr_t)targ);
 #else
-			pptr->energy += INFLOW_RATE_BASE;
-#endif /* INFLOW_RATE_VARIATION */
-			for(i=0;i<POND_DEPTH_SYSWORDS;++i) 
-				pptr->genome[i] = getRandom();
-			++cellIdCounter;
-		
-			/* Update the random cell on SDL screen if viz is enabled */
-#ifdef USE_SDL
-			((uint8_t *)screen->pixels)[x + (y * sdlPitch)] = getColor(pptr);
-#endif /* USE_SDL */
+	runRandom((uintptr_t)targ);
+#endif
+	return (void *)0;
+}
+
+#ifndef USE_SDL
+static void stopSignal(int sig)
+{
+	(void)sig;
+	exitNow = 1;
+}
+#endif
 
+static void usage(const char *const argv0)
+{
+	fprintf(stderr,"Usage: %s [options]\n",argv0);
+#ifndef FIXED_POND_SIZE
+	fprintf(stderr,"  -x <cells>   Pond width (default %u)\n",(unsigned int)POND_SIZE_X);
+	fprintf(stderr,"  -y <cells>   Pond height (default %u)\n",(unsigned int)POND_SIZE_Y);
+#endif
+	fprintf(stderr,"  -m <rate>    Mutation rate out of 2^32 (default %u)\n",(unsigned int)MUTATION_RATE);
+	fprintf(stderr,"  -f <ticks>   Inflow frequency (default %u)\n",(unsigned int)INFLOW_FREQUENCY);
+	fprintf(stderr,"  -b <energy>  Inflow rate base (default %u)\n",(unsigned int)INFLOW_RATE_BASE);
+	fprintf(stderr,"  -v <energy>  Inflow rate variation, 0 for none (default %u)\n",(unsigned int)inflowRateVariation);
+	fprintf(stderr,"  -K <divisor> Failed KILL penalty divisor (default %u)\n",(unsigned int)FAILED_KILL_PENALTY);
+	fprintf(stderr,"  -r <ticks>   Report frequency (default %u)\n",(unsigned int)REPORT_FREQUENCY);
+	fprintf(stderr,"  -n <ticks>   Stop after <ticks> ticks per thread, 0 for never (default %llu)\n",(unsigned long long)runTicks);
 #ifdef USE_PTHREADS_COUNT
-			pthread_mutex_unlock(&(pptr->lock));
+	fprintf(stderr,"  -w <ms>      Report every <ms> milliseconds from a reporter thread instead\n");
 #endif
-		}
+#ifdef USE_PTHREADS_COUNT
+	fprintf(stderr,"  -t <count>   Number of threads (default %u)\n",(unsigned int)USE_PTHREADS_COUNT);
+#endif
+#ifdef USE_CONTROL
+	fprintf(stderr,"  -C <path>    Serve a control socket at <path> (see the source for commands)\n");
+#endif
+	fprintf(stderr,"  -c <file>    Write checkpoints to file\n");
+	fprintf(stderr,"  -k <ticks>   Checkpoint frequency, 0 for only at exit (default %u)\n",(unsigned int)CHECKPOINT_FREQUENCY);
+	fprintf(stderr,"  -l <file>    Restore from a checkpoint file\n");
+	fprintf(stderr,"  -g <prefix>  Write genome censuses to <prefix><clock>" CENSUS_SUFFIX "\n");
+	fprintf(stderr,"  -G <reports> Census frequency (default %u)\n",(unsigned int)CENSUS_FREQUENCY);
+	fprintf(stderr,"  -s <seed>    Random seed (default %s)\n",
+#ifdef BENCHMARK_TICKS
+		"1"
+#else
+		"from the time"
+#endif
+		);
+#ifndef USE_SDL
+	fprintf(stderr,"  -S <file>    Run a parameter sweep, one pond per line of options in file\n");
+	fprintf(stderr,"  -P <ponds>   Sweep ponds to run at once (default one per CPU)\n");
+#endif
+	exit(1);
+}
 
-		/* Pick a random cell to execute */
-		i = getRandom();
-		x = i % POND_SIZE_X;
-		y = ((i / POND_SIZE_X) >> 1) % POND_SIZE_Y;
-		pptr = &pond[x][y];
-
-		/* Reset the state of the VM prior to execution */
-		for(i=0;i<POND_DEPTH_SYSWORDS;++i)
-			outputBuf[i] = ~((uintptr_t)0); /* ~0 == 0xfffff... */
-		ptr_wordPtr = 0;
-		ptr_shiftPtr = 0;
-		reg = 0;
-		loopStackPtr = 0;
-		wordPtr = EXEC_START_WORD;
-		shiftPtr = EXEC_START_BIT;
-		facing = 0;
-		falseLoopDepth = 0;
-		stop = 0;
-
-		/* We use a currentWord buffer to hold the word we're
-		 * currently working on.  This speeds things up a bit
-		 * since it eliminates a pointer dereference in the
-		 * inner loop. We have to be careful to refresh this
-		 * whenever it might have changed... take a look at
-		 * the code. :) */
-		currentWord = pptr->genome[0];
-
-		/* Keep track of how many cells have been executed */
-		statCounters.cellExecutions += 1.0;
-
-		/* Core execution loop */
-		while ((pptr->energy)&&(!stop)) {
-			/* Get the next instruction */
-			inst = (currentWord >> shiftPtr) & 0xf;
-
-			/* Randomly frob either the instruction or the register with a
-			 * probability defined by MUTATION_RATE. This introduces variation,
-			 * and since the variation is introduced into the state of the VM
-			 * it can have all manner of different effects on the end result of
-			 * replication: insertions, deletions, duplications of entire
-			 * ranges of the genome, etc. */
-			if ((getRandom() & 0xffffffff) < MUTATION_RATE) {
-				tmp = getRandom(); /* Call getRandom() only once for speed */
-				if (tmp & 0x80) /* Check for the 8th bit to get random boolean */
-					inst = tmp & 0xf; /* Only the first four bits are used here */
-				else reg = tmp & 0xf;
-			}
+/* Parses a numeric option, exiting with usage if it's not in range */
+static uint64_t parseOption(const char *const argv0,const int opt,const char *const arg,const uint64_t min,const uint64_t max)
+{
+	char *end = (char *)0;
+	const unsigned long long v = strtoull(arg,&end,0);
+	if ((!*arg)||(*end)||(v < min)||(v > max)) {
+		fprintf(stderr,"*** Invalid value for -%c: %s ***\n",opt,arg);
+		usage(argv0);
+	}
+	return (uint64_t)v;
+}
 
-			/* Each instruction processed costs one unit of energy */
-			--pptr->energy;
-
-			/* Execute the instruction */
-			if (falseLoopDepth) {
-				/* Skip forward to matching REP if we're in a false loop. */
-				if (inst == 0x9) /* Increment false LOOP depth */
-					++falseLoopDepth;
-				else if (inst == 0xa) /* Decrement on REP */
-					--falseLoopDepth;
-			} else {
-				/* If we're not in a false LOOP/REP, execute normally */
-				
-				/* Keep track of execution frequencies for each instruction */
-				statCounters.instructionExecutions[inst] += 1.0;
-				
-				switch(inst) {
-					case 0x0: /* ZERO: Zero VM state registers */
-						reg = 0;
-						ptr_wordPtr = 0;
-						ptr_shiftPtr = 0;
-						facing = 0;
-						break;
-					case 0x1: /* FWD: Increment the pointer (wrap at end) */
-						if ((ptr_shiftPtr += 4) >= SYSWORD_BITS) {
-							if (++ptr_wordPtr >= POND_DEPTH_SYSWORDS)
-								ptr_wordPtr = 0;
-							ptr_shiftPtr = 0;
-						}
-						break;
-					case 0x2: /* BACK: Decrement the pointer (wrap at beginning) */
-						if (ptr_shiftPtr)
-							ptr_shiftPtr -= 4;
-						else {
-							if (ptr_wordPtr)
-								--ptr_wordPtr;
-							else ptr_wordPtr = POND_DEPTH_SYSWORDS - 1;
-							ptr_shiftPtr = SYSWORD_BITS - 4;
-						}
-						break;
-					case 0x3: /* INC: Increment the register */
-						reg = (reg + 1) & 0xf;
-						break;
-					case 0x4: /* DEC: Decrement the register */
-						reg = (reg - 1) & 0xf;
-						break;
-					case 0x5: /* READG: Read into the register from genome */
-						reg = (pptr->genome[ptr_wordPtr] >> ptr_shiftPtr) & 0xf;
-						break;
-					case 0x6: /* WRITEG: Write out from the register to genome */
-						pptr->genome[ptr_wordPtr] &= ~(((uintptr_t)0xf) << ptr_shiftPtr);
-						pptr->genome[ptr_wordPtr] |= reg << ptr_shiftPtr;
-						currentWord = pptr->genome[wordPtr]; /* Must refresh in case this changed! */
-						break;
-					case 0x7: /* READB: Read into the register from buffer */
-						reg = (outputBuf[ptr_wordPtr] >> ptr_shiftPtr) & 0xf;
-						break;
-					case 0x8: /* WRITEB: Write out from the register to buffer */
-						outputBuf[ptr_wordPtr] &= ~(((uintptr_t)0xf) << ptr_shiftPtr);
-						outputBuf[ptr_wordPtr] |= reg << ptr_shiftPtr;
-						break;
-					case 0x9: /* LOOP: Jump forward to matching REP if register is zero */
-						if (reg) {
-							if (loopStackPtr >= POND_DEPTH)
-								stop = 1; /* Stack overflow ends execution */
-							else {
-								loopStack_wordPtr[loopStackPtr] = wordPtr;
-								loopStack_shiftPtr[loopStackPtr] = shiftPtr;
-								++loopStackPtr;
-							}
-						} else falseLoopDepth = 1;
-						break;
-					case 0xa: /* REP: Jump back to matching LOOP if register is nonzero */
-						if (loopStackPtr) {
-							--loopStackPtr;
-							if (reg) {
-								wordPtr = loopStack_wordPtr[loopStackPtr];
-								shiftPtr = loopStack_shiftPtr[loopStackPtr];
-								currentWord = pptr->genome[wordPtr];
-								/* This ensures that the LOOP is rerun */
-								continue;
-							}
-						}
-						break;
-					case 0xb: /* TURN: Turn in the direction specified by register */
-						facing = reg & 3;
-						break;
-					case 0xc: /* XCHG: Skip next instruction and exchange value of register with it */
-						if ((shiftPtr += 4) >= SYSWORD_BITS) {
-							if (++wordPtr >= POND_DEPTH_SYSWORDS) {
-								wordPtr = EXEC_START_WORD;
-								shiftPtr = EXEC_START_BIT;
-							} else shiftPtr = 0;
-						}
-						tmp = reg;
-						reg = (pptr->genome[wordPtr] >> shiftPtr) & 0xf;
-						pptr->genome[wordPtr] &= ~(((uintptr_t)0xf) << shiftPtr);
-						pptr->genome[wordPtr] |= tmp << shiftPtr;
-						currentWord = pptr->genome[wordPtr];
-						break;
-					case 0xd: /* KILL: Blow away neighboring cell if allowed with penalty on failure */
-						tmpptr = getNeighbor(x,y,facing);
-						if (accessAllowed(tmpptr,reg,0)) {
-							if (tmpptr->generation > 2)
-								++statCounters.viableCellsKilled;
+#ifndef USE_SDL
+/* Sweep file given with -S, or null for none */
+static const char *sweepFile = (const char *)0;
+static uintptr_t sweepPonds = SWEEP_PONDS;
+#endif
 
-							/* Filling first two words with 0xfffff... is enough */
-							tmpptr->genome[0] = ~((uintptr_t)0);
-							tmpptr->genome[1] = ~((uintptr_t)0);
-							tmpptr->ID = cellIdCounter;
-							tmpptr->parentID = 0;
-							tmpptr->lineage = cellIdCounter;
-							tmpptr->generation = 0;
-							++cellIdCounter;
-						} else if (tmpptr->generation > 2) {
-							tmp = pptr->energy / FAILED_KILL_PENALTY;
-							if (pptr->energy > tmp)
-								pptr->energy -= tmp;
-							else pptr->energy = 0;
-						}
-						break;
-					case 0xe: /* SHARE: Equalize energy between self and neighbor if allowed */
-						tmpptr = getNeighbor(x,y,facing);
-						if (accessAllowed(tmpptr,reg,1)) {
-#ifdef USE_PTHREADS_COUNT
-							pthread_mutex_lock(&(tmpptr->lock));
+/**
+ * Parses command line options into the run time parameters
+ *
+ * @param argc Number of args
+ * @param argv Argument array
+ * @param restoreFile Set to the checkpoint to restore, if any
+ * @param seeded Set to nonzero if a seed was given
+ */
+static void parseOptions(int argc,char **argv,const char **const restoreFile,int *const seeded)
+{
+	int opt;
+	optind = 1;
+	while ((opt = getopt(argc,argv,"x:y:m:f:b:v:K:r:n:w:t:C:c:k:l:g:G:s:S:P:h")) != -1) {
+		switch(opt) {
+#ifndef FIXED_POND_SIZE
+			case 'x': pondSizeX = (uintptr_t)parseOption(argv[0],opt,optarg,1,65536); break;
+			case 'y': pondSizeY = (uintptr_t)parseOption(argv[0],opt,optarg,1,65536); break;
 #endif
-							if (tmpptr->generation > 2)
-								++statCounters.viableCellShares;
-							tmp = pptr->energy + tmpptr->energy;
-							tmpptr->energy = tmp / 2;
-							pptr->energy = tmp - tmpptr->energy;
+			case 'm': mutationRate = (uint32_t)parseOption(argv[0],opt,optarg,0,0xffffffff); break;
+			case 'f': inflowFrequency = (uintptr_t)parseOption(argv[0],opt,optarg,1,0xffffffff); break;
+			case 'b': inflowRateBase = (uintptr_t)parseOption(argv[0],opt,optarg,0,0xffffffff); break;
+			case 'v': inflowRateVariation = (uintptr_t)parseOption(argv[0],opt,optarg,0,0xffffffff); break;
+			case 'K': failedKillPenalty = (uintptr_t)parseOption(argv[0],opt,optarg,1,0xffffffff); break;
+			case 'r': reportFrequency = (uintptr_t)parseOption(argv[0],opt,optarg,1,0xffffffff); break;
+			case 'n': runTicks = parseOption(argv[0],opt,optarg,0,~((uint64_t)0)); break;
 #ifdef USE_PTHREADS_COUNT
-							pthread_mutex_unlock(&(tmpptr->lock));
+			case 'w': reportInterval = (uintptr_t)parseOption(argv[0],opt,optarg,1,86400000); break;
+			case 't': threadCount = (uintptr_t)parseOption(argv[0],opt,optarg,1,1024); break;
 #endif
-						}
-						break;
-					case 0xf: /* STOP: End execution */
-						stop = 1;
-						break;
-				}
-			}
-			
-			/* Advance the shift and word pointers, and loop around
-			 * to the beginning at the end of the genome. */
-			if ((shiftPtr += 4) >= SYSWORD_BITS) {
-				if (++wordPtr >= POND_DEPTH_SYSWORDS) {
-					wordPtr = EXEC_START_WORD;
-					shiftPtr = EXEC_START_BIT;
-				} else shiftPtr = 0;
-				currentWord = pptr->genome[wordPtr];
-			}
+#ifdef USE_CONTROL
+			case 'C': controlPath = optarg; break;
+#endif
+			case 'c': checkpointFile = optarg; break;
+			case 'k': checkpointFrequency = parseOption(argv[0],opt,optarg,0,~((uint64_t)0)); break;
+			case 'l': *restoreFile = optarg; break;
+			case 'g': censusPrefix = optarg; break;
+			case 'G': censusFrequency = (uintptr_t)parseOption(argv[0],opt,optarg,1,0xffffffff); break;
+			case 's': prngSeed = parseOption(argv[0],opt,optarg,0,~((uint64_t)0)); *seeded = 1; break;
+#ifndef USE_SDL
+			case 'S': sweepFile = optarg; break;
+			case 'P': sweepPonds = (uintptr_t)parseOption(argv[0],opt,optarg,1,65536); break;
+#endif
+			default: usage(argv[0]);
 		}
+	}
+	if (optind < argc)
+		usage(argv[0]);
+}
 
-		/* Copy outputBuf into neighbor if access is permitted and there
-		 * is energy there to make something happen. There is no need
-		 * to copy to a cell with no energy, since anything copied there
-		 * would never be executed and then would be replaced with random
-		 * junk eventually. See the seeding code in the main loop above. */
-		if ((outputBuf[0] & 0xff) != 0xff) {
-			tmpptr = getNeighbor(x,y,facing);
-#ifdef USE_PTHREADS_COUNT
-			pthread_mutex_lock(&(tmpptr->lock));
+#ifndef USE_SDL
+/*
+ * Parameter sweeps
+ *
+ * With -S every non-empty line of the sweep file not starting with # is
+ * the options for one pond, on top of those given on the command line;
+ * for example "-m 5000 -b 600 -K 3 -x 200 -y 200 -n 10000000". Ponds are
+ * run as child processes forked from this one before any pond memory is
+ * allocated, so each only has the memory of its own pond. Up to
+ * sweepPonds run at a time, and whenever one finishes the next waiting
+ * pond starts, so ponds that run at different speeds keep every CPU
+ * busy. Ponds run one thread each unless their line says otherwise.
+ *
+ * Pond n (counting lines from 1) reports to <file>.<n>.csv and logs to
+ * <file>.<n>.log. Unless its line has -s it is seeded with the sweep's
+ * seed plus n, so a sweep with a seed is reproducible.
+ */
+
+/* Reads the ponds in sweepFile, exiting if it can't be read */
+static char **readSweep(uintptr_t *const count)
+{
+	/* getline() grows line to fit, so a long line is never split into
+	 * two ponds */
+	char *line = (char *)0;
+	size_t lineCapacity = 0;
+	char **ponds = (char **)0;
+	uintptr_t capacity = 0;
+	const char *p;
+	FILE *f = fopen(sweepFile,"r");
+	if (!f) {
+		fprintf(stderr,"*** Unable to open sweep file %s ***\n",sweepFile);
+		exit(1);
+	}
+	*count = 0;
+	while (getline(&line,&lineCapacity,f) >= 0) {
+		for(p=line;(*p == ' ')||(*p == '\t');++p);
+		if ((*p == '#')||(*p == '\n')||(*p == '\r')||(!*p))
+			continue;
+		ponds = (char **)growArray(ponds,&capacity,*count + 1,sizeof(char *));
+		ponds[(*count)++] = strdup(line);
+	}
+	free(line);
+	fclose(f);
+	return ponds;
+}
+
+/**
+ * Runs the sweep in sweepFile
+ *
+ * This only returns in a child process, which has then parsed its pond's
+ * options and goes on to run that pond. The parent exits when all ponds
+ * have finished, with status 1 if any of them failed.
+ *
+ * @param argv0 Program name
+ * @param restoreFile As for parseOptions()
+ * @param seeded As for parseOptions()
+ */
+static void runSweep(const char *const argv0,const char **const restoreFile,int *const seeded)
+{
+	char path[4096];
+	char *args[256];
+	uintptr_t count,n,k,running = 0,failed = 0;
+	int argCount,status;
+	char **const ponds = readSweep(&count);
+	pid_t *const pids = (pid_t *)calloc(count + 1,sizeof(pid_t));
+	pid_t pid;
+
+	if (!sweepPonds) {
+		const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		sweepPonds = (cpus > 0) ? (uintptr_t)cpus : 1;
+	}
+	if (!*seeded) {
+#ifdef BENCHMARK_TICKS
+		prngSeed = BENCHMARK_SEED;
+#else
+		prngSeed = ((uint64_t)time(NULL) << 32) ^ (uint64_t)getpid();
 #endif
-			if ((tmpptr->energy)&&accessAllowed(tmpptr,reg,0)) {
-				/* Log it if we're replacing a viable cell */
-				if (tmpptr->generation > 2)
-					++statCounters.viableCellsReplaced;
-				
-				tmpptr->ID = ++cellIdCounter;
-				tmpptr->parentID = pptr->ID;
-				tmpptr->lineage = pptr->lineage; /* Lineage is copied in offspring */
-				tmpptr->generation = pptr->generation + 1;
+	}
+	fprintf(stderr,"[SWEEP] %llu ponds, %llu at a time, seed %llu\n",(unsigned long long)count,(unsigned long long)sweepPonds,(unsigned long long)prngSeed);
 
-				for(i=0;i<POND_DEPTH_SYSWORDS;++i)
-					tmpptr->genome[i] = outputBuf[i];
-			}
+	for(n=0;n<=count;++n) {
+		/* Wait for a pond to finish if there are enough running, or for
+		 * all of them at the end */
+		while ((running)&&((running >= sweepPonds)||(n == count))) {
+			pid = wait(&status);
+			if (pid < 0)
+				break;
+			--running;
+			for(k=0;(k<n)&&(pids[k] != pid);++k);
+			if ((!WIFEXITED(status))||(WEXITSTATUS(status))) {
+				++failed;
+				fprintf(stderr,"[SWEEP] *** Pond %llu failed, see %s.%llu.log ***\n",(unsigned long long)(k + 1),sweepFile,(unsigned long long)(k + 1));
+			} else fprintf(stderr,"[SWEEP] Pond %llu finished\n",(unsigned long long)(k + 1));
+		}
+		if (n == count)
+			break;
+
+		fflush(stdout);
+		fflush(stderr);
+		pid = fork();
+		if (pid < 0) {
+			fprintf(stderr,"*** Unable to fork for sweep pond %llu ***\n",(unsigned long long)(n + 1));
+			exit(1);
+		}
+		if (pid) {
+			pids[n] = pid;
+			++running;
+			fprintf(stderr,"[SWEEP] Pond %llu (process %d): %s",(unsigned long long)(n + 1),(int)pid,ponds[n]);
+			continue;
+		}
+
+		/* Child: send output to the pond's files and take its options */
+		snprintf(path,sizeof(path),"%s.%llu.csv",sweepFile,(unsigned long long)(n + 1));
+		if (!freopen(path,"w",stdout)) {
+			fprintf(stderr,"*** Unable to open %s ***\n",path);
+			exit(1);
+		}
+		snprintf(path,sizeof(path),"%s.%llu.log",sweepFile,(unsigned long long)(n + 1));
+		if (!freopen(path,"w",stderr))
+			exit(1);
+		sweepFile = (const char *)0;
+		prngSeed += (uint64_t)(n + 1);
+		*seeded = 1;
 #ifdef USE_PTHREADS_COUNT
-			pthread_mutex_unlock(&(tmpptr->lock));
+		threadCount = 1;
 #endif
+		args[0] = (char *)argv0;
+		argCount = 1;
+		for(args[argCount]=strtok(ponds[n]," \t\r\n");(args[argCount])&&(argCount < 255);args[argCount]=strtok((char *)0," \t\r\n"))
+			++argCount;
+		if (args[argCount]) {
+			fprintf(stderr,"*** Too many options for one sweep pond ***\n");
+			exit(1);
 		}
-
-		/* Update the neighborhood on SDL screen to show any changes. */
-#ifdef USE_SDL
-		((uint8_t *)screen->pixels)[x + (y * sdlPitch)] = getColor(pptr);
-		if (x) {
-			((uint8_t *)screen->pixels)[(x-1) + (y * sdlPitch)] = getColor(&pond[x-1][y]);
-			if (x < (POND_SIZE_X-1))
-				((uint8_t *)screen->pixels)[(x+1) + (y * sdlPitch)] = getColor(&pond[x+1][y]);
-			else ((uint8_t *)screen->pixels)[y * sdlPitch] = getColor(&pond[0][y]);
-		} else {
-			((uint8_t *)screen->pixels)[(POND_SIZE_X-1) + (y * sdlPitch)] = getColor(&pond[POND_SIZE_X-1][y]);
-			((uint8_t *)screen->pixels)[1 + (y * sdlPitch)] = getColor(&pond[1][y]);
-		}
-		if (y) {
-			((uint8_t *)screen->pixels)[x + ((y-1) * sdlPitch)] = getColor(&pond[x][y-1]);
-			if (y < (POND_SIZE_Y-1))
-				((uint8_t *)screen->pixels)[x + ((y+1) * sdlPitch)] = getColor(&pond[x][y+1]);
-			else ((uint8_t *)screen->pixels)[x] = getColor(&pond[x][0]);
-		} else {
-			((uint8_t *)screen->pixels)[x + ((POND_SIZE_Y-1) * sdlPitch)] = getColor(&pond[x][POND_SIZE_Y-1]);
-			((uint8_t *)screen->pixels)[x + sdlPitch] = getColor(&pond[x][1]);
+		args[argCount] = (char *)0;
+		parseOptions(argCount,args,restoreFile,seeded);
+		if (sweepFile) {
+			fprintf(stderr,"*** Sweep ponds can't run sweeps ***\n");
+			exit(1);
 		}
-#endif /* USE_SDL */
+		return;
 	}
 
-	return (void *)0;
+	fprintf(stderr,"[SWEEP] Done, %llu of %llu ponds failed\n",(unsigned long long)failed,(unsigned long long)count);
+	exit(failed ? 1 : 0);
 }
+#endif /* !USE_SDL */
 
 /**
  * Main method
@@ -939,17 +6066,128 @@ static void *run(void *targ)
  */
 int main(int argc,char **argv)
 {
-	uintptr_t i,x,y;
+	uintptr_t i;
+	int seeded = 0;
+	const char *restoreFile = (const char *)0;
+	struct CheckpointHeader restoreHeader;
+	int restoreFd = -1;
+#ifdef KINSHIP_CHECK_GENOMES
+	kinshipCheck();
+	return 0;
+#endif
+#ifdef USE_MPI
+	char rankCensusPrefix[4096];
+	int mpiThreads;
 
-	/* Seed and init the random number generator */
-	prngState[0] = (uint64_t)time(NULL);
-	srand(time(NULL));
-	prngState[1] = (uint64_t)rand();
+	/* Only thread 0 makes MPI calls */
+	MPI_Init_thread(&argc,&argv,MPI_THREAD_FUNNELED,&mpiThreads);
+	MPI_Comm_rank(MPI_COMM_WORLD,&mpiRank);
+	MPI_Comm_size(MPI_COMM_WORLD,&mpiRanks);
+#endif
+
+	parseOptions(argc,argv,&restoreFile,&seeded);
+#ifdef USE_GPU_ENGINE
+	/* Kernels run the tiles, driven by one host thread */
+	if (reportInterval) {
+		fprintf(stderr,"*** Wall clock reports are not supported with USE_GPU_ENGINE ***\n");
+		exit(1);
+	}
+	threadCount = 1;
+#endif
+#ifdef USE_MPI
+	if ((sweepFile)||(checkpointFile)||(restoreFile)||(reportInterval)) {
+		fprintf(stderr,"*** Sweeps, checkpoints and wall clock reports are not supported with USE_MPI ***\n");
+		exit(1);
+	}
+	if (pondSizeX % (uintptr_t)mpiRanks) {
+		fprintf(stderr,"*** The pond width must be a multiple of the number of ranks (%d) ***\n",mpiRanks);
+		exit(1);
+	}
+	/* Each rank has its strip plus a ghost column on each side */
+	pondSizeX = (pondSizeX / (uintptr_t)mpiRanks) + 2;
+	if (censusPrefix) {
+		snprintf(rankCensusPrefix,sizeof(rankCensusPrefix),"%srank%d-",censusPrefix,mpiRank);
+		censusPrefix = rankCensusPrefix;
+	}
+#endif
+#ifndef USE_SDL
+#ifdef USE_CONTROL
+	if ((sweepFile)&&(controlPath)) {
+		fprintf(stderr,"*** A control socket is not supported with sweeps ***\n");
+		exit(1);
+	}
+#endif
+	if (sweepFile)
+		runSweep(argv[0],&restoreFile,&seeded);
+#endif
+	if (restoreFile)
+		restoreFd = openCheckpoint(restoreFile,&restoreHeader);
+#ifdef USE_TILED_SCHEDULER
+	if (((POND_OWNED_SIZE_X / TILES_X) < 2)||((pondSizeY / TILES_Y) < 2)) {
+		fprintf(stderr,"*** The pond must be at least %u by %u cells for the tiled scheduler ***\n",(unsigned int)(TILES_X * 2),(unsigned int)(TILES_Y * 2));
+		exit(1);
+	}
+#endif
+#ifdef USE_POW2_POND
+	if ((pondSizeX & (pondSizeX - 1))||(pondSizeY & (pondSizeY - 1))) {
+		fprintf(stderr,"*** The pond size must be a power of two in both dimensions ***\n");
+		exit(1);
+	}
+#ifndef FIXED_POND_SIZE
+	pondShiftX = (uintptr_t)__builtin_ctzl(pondSizeX);
+	pondShiftY = (uintptr_t)__builtin_ctzl(pondSizeY);
+#endif
+	initNeighborOffsets();
+#endif
+	if (mutationRate)
+		mutationGapScale = 1.0 / log1p(-((double)mutationRate / 4294967296.0));
+
+	/* Seed the random number generator; each thread derives its own
+	 * state from this when it starts. */
+	if (!seeded) {
+#ifdef BENCHMARK_TICKS
+		prngSeed = BENCHMARK_SEED;
+#else
+		srand(time(NULL));
+		prngSeed = ((uint64_t)time(NULL) << 32) ^ (uint64_t)rand();
+#endif
+	}
+
+	/* Allocate the pond and per-thread state */
+	allocPond();
+#ifdef USE_CELL_LOCKS
+#ifndef CELL_LOCK_STRIPES
+	cellLocks = (uint32_t *)allocPondMemory(sizeof(uint32_t) * POND_SIZE);
+#endif
+#endif
+#ifndef USE_TILED_SCHEDULER
+	prngState = (struct PRNG *)allocPondMemory(sizeof(struct PRNG) * threadCount);
+#endif
+	statCounters = (struct StatCounters *)allocPondMemory(sizeof(struct StatCounters) * threadCount);
+	loopIndex = (struct LoopIndex *)allocPondMemory(sizeof(struct LoopIndex) * threadCount);
+#ifdef USE_BATCH_ENGINE
+	batches = (struct Batch *)allocPondMemory(sizeof(struct Batch) * threadCount);
+#endif
+	statSnapshots = (struct StatSnapshot *)allocPondMemory(sizeof(struct StatSnapshot) * threadCount);
+#ifdef USE_NUMA
+	sched_getaffinity(0,sizeof(numaCpus),&numaCpus);
+#endif
+#ifdef USE_GENOME_STORE
+	initGenomeStore();
+#endif
+#if defined(USE_GENOME_STORE) || defined(USE_NUMA)
+	initPond();
+#endif
+
+	/* Each thread (or tile) derives its own generator state from the
+	 * global seed */
+#ifdef USE_TILED_SCHEDULER
+	initTiles();
+#else
+	for(i=0;i<threadCount;++i)
+		seedRandom(&prngState[i],prngSeed,i);
+#endif
 
-	/* Reset per-report stat counters */
-	for(x=0;x<sizeof(statCounters);++x)
-		((uint8_t *)&statCounters)[x] = (uint8_t)0;
-	
 	/* Set up SDL if we're using it */
 #ifdef USE_SDL
 	if (SDL_Init(SDL_INIT_VIDEO) < 0 ) {
@@ -957,7 +6195,7 @@ int main(int argc,char **argv)
 		exit(1);
 	}
 	atexit(SDL_Quit);
-	window = SDL_CreateWindow("nanopond", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, POND_SIZE_X, POND_SIZE_Y, 0);
+	window = SDL_CreateWindow("nanopond", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, (int)pondSizeX, (int)pondSizeY, 0);
 	if (!window) {
 		fprintf(stderr, "*** Unable to create SDL window: %s ***\n", SDL_GetError());
 		exit(1);
@@ -967,7 +6205,7 @@ int main(int argc,char **argv)
 		fprintf(stderr, "*** Unable to get SDL window surface: %s ***\n", SDL_GetError());
 		exit(1);
 	}
-	screen = SDL_CreateRGBSurface(0, POND_SIZE_X, POND_SIZE_Y, 8, 0, 0, 0, 0);
+	screen = SDL_CreateRGBSurface(0, (int)pondSizeX, (int)pondSizeY, 8, 0, 0, 0, 0);
 	if (!screen) {
 		fprintf(stderr, "*** Unable to create SDL window surface: %s ***\n", SDL_GetError());
 		exit(1);
@@ -988,40 +6226,149 @@ int main(int argc,char **argv)
 			}
 		}
 	}
+	dirtyCells = (uint64_t *)allocPondMemory(sizeof(uint64_t) * DIRTY_CELL_WORDS);
+	dirtyRegions = (uint64_t *)allocPondMemory(sizeof(uint64_t) * DIRTY_REGION_WORDS);
 #endif /* USE_SDL */
  
-	/* Clear the pond and initialize all genomes
-	 * to 0xffff... */
-	for(x=0;x<POND_SIZE_X;++x) {
-		for(y=0;y<POND_SIZE_Y;++y) {
-			pond[x][y].ID = 0;
-			pond[x][y].parentID = 0;
-			pond[x][y].lineage = 0;
-			pond[x][y].generation = 0;
-			pond[x][y].energy = 0;
-			for(i=0;i<POND_DEPTH_SYSWORDS;++i)
-				pond[x][y].genome[i] = ~((uintptr_t)0);
-#ifdef USE_PTHREADS_COUNT
-			pthread_mutex_init(&(pond[x][y].lock),0);
+	if (restoreFd >= 0) {
+		restoreCheckpoint(restoreFd,&restoreHeader);
+		fprintf(stderr,"[CHECKPOINT] Restored %s at clock %llu\n",restoreFile,(unsigned long long)startClock);
+#ifdef USE_SDL
+		markAllDirty();
+#endif
+#ifdef USE_INCREMENTAL_STATS
+		scanPond(&pondBase);
 #endif
-		}
 	}
+#ifdef USE_MPI
+	initHalos();
+	exchangeHalos();
+#endif
+
+#ifndef USE_SDL
+	/* Without SDL to catch these, stop cleanly so there is a final
+	 * checkpoint */
+	signal(SIGINT,stopSignal);
+	signal(SIGTERM,stopSignal);
+#endif
+
+#ifdef BENCHMARK_TICKS
+	const double benchStart = getSeconds();
+	const uint64_t benchStartCycles = getCycles();
+#endif
 
 #ifdef USE_PTHREADS_COUNT
-	pthread_t threads[USE_PTHREADS_COUNT];
-	for(i=1;i<USE_PTHREADS_COUNT;++i)
+	pthread_t *const threads = (pthread_t *)malloc(sizeof(pthread_t) * threadCount);
+	pthread_t reporterThread;
+#ifdef USE_CONTROL
+	pthread_t controlThread;
+	if (controlPath) {
+		openControl();
+		pthread_create(&controlThread,0,controller,(void *)0);
+	}
+#endif
+	if (reportInterval)
+		pthread_create(&reporterThread,0,reporter,(void *)0);
+	for(i=1;i<threadCount;++i)
 		pthread_create(&threads[i],0,run,(void *)i);
 	run((void *)0);
-	for(i=1;i<USE_PTHREADS_COUNT;++i)
+	for(i=1;i<threadCount;++i)
 		pthread_join(threads[i],(void **)0);
+	free(threads);
+	if (reportInterval) {
+		exitNow = 1;
+		pthread_join(reporterThread,(void **)0);
+	}
+#ifdef USE_CONTROL
+	if (controlPath) {
+		exitNow = 1;
+		pthread_join(controlThread,(void **)0);
+		close(controlFd);
+		unlink(controlPath);
+	}
+#endif
 #else
 	run((void *)0);
 #endif
 
+	finishCensus();
+
+	if (checkpointFile) {
+		reapCheckpoint(1);
+		if (writeCheckpoint(stopClock))
+			fprintf(stderr,"[CHECKPOINT] Wrote %s at clock %llu\n",checkpointFile,(unsigned long long)stopClock);
+		else fprintf(stderr,"[CHECKPOINT] *** Writing %s failed ***\n",checkpointFile);
+	}
+
+#ifdef BENCHMARK_TICKS
+	{
+		const double benchSeconds = getSeconds() - benchStart;
+		const uint64_t benchCycles = getCycles() - benchStartCycles;
+		struct StatCounters totals;
+		uint64_t instructions = 0;
+		sumStatCounters(&totals);
+		for(i=0;i<16;++i)
+			instructions += totals.instructionExecutions[i];
+		fprintf(stderr,"[BENCHMARK] %s pond, %s dispatch, %u thread(s), %llu ticks per thread, lookahead %u\n",
+#ifdef USE_SOA_POND
+			"SoA",
+#else
+			"AoS",
+#endif
+#ifdef USE_THREADED_DISPATCH
+			"threaded",
+#else
+			"switch",
+#endif
+			(unsigned int)threadCount,(unsigned long long)runTicks,
+#ifdef CELL_PREFETCH_DEPTH
+			(unsigned int)CELL_PREFETCH_DEPTH
+#else
+			0U
+#endif
+			);
+		fprintf(stderr,"[BENCHMARK] %.3f seconds, %.0f cells/sec, %.0f instructions/sec\n",
+			benchSeconds,
+			(double)totals.cellExecutions / benchSeconds,
+			(double)instructions / benchSeconds);
+		if ((benchCycles)&&(totals.cellExecutions))
+			fprintf(stderr,"[BENCHMARK] %.0f reference cycles per cell execution per thread\n",((double)benchCycles * (double)threadCount) / (double)totals.cellExecutions);
+#ifdef USE_GENOME_STORE
+		{
+			/* Blocks can be freed to another stripe than they came from,
+			 * so only the sums mean anything */
+			uintptr_t blocks = 0,blocksUsed = 0;
+			for(i=0;i<GENOME_STORE_STRIPES;++i) {
+				blocks += genomeStripes[i].blocks;
+				blocksUsed += genomeStripes[i].blocksUsed;
+			}
+			fprintf(stderr,"[BENCHMARK] %llu genome blocks in use of %llu allocated (%.1f MiB)\n",
+				(unsigned long long)blocksUsed,(unsigned long long)blocks,
+				((double)blocks * (double)sizeof(struct GenomeBlock)) / 1048576.0);
+		}
+#endif
+		fprintf(stderr,"[BENCHMARK] %.3f ms per report scan (%llu scans)\n",
+			(benchReportScans > 0) ? ((benchReportScanSeconds * 1000.0) / (double)benchReportScans) : 0.0,
+			(unsigned long long)benchReportScans);
+
+		/* Threads, ticks per thread, seconds, cells/sec, instructions/sec,
+		 * reference cycles per cell execution per thread */
+		fprintf(stderr,"[RESULT] %u,%llu,%.3f,%.0f,%.0f,%.0f\n",
+			(unsigned int)threadCount,(unsigned long long)runTicks,benchSeconds,
+			(double)totals.cellExecutions / benchSeconds,
+			(double)instructions / benchSeconds,
+			(totals.cellExecutions) ? (((double)benchCycles * (double)threadCount) / (double)totals.cellExecutions) : 0.0);
+	}
+#endif /* BENCHMARK_TICKS */
+
 #ifdef USE_SDL
 	SDL_FreeSurface(screen);
 	SDL_DestroyWindow(window);
 #endif /* USE_SDL */
 
+#ifdef USE_MPI
+	MPI_Finalize();
+#endif
+
 	return 0;
 }